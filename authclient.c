@@ -0,0 +1,683 @@
+/**
+ * @file authclient.c
+ * @author David Schrder 1226747
+ * @brief Client side of the shm and socket transport
+ * @details Used by auth-client and auth-bench. Errors are returned and
+ *          described in conn->error, the caller decides whether to exit.
+ * @date 08.01.2017
+ */
+#include "authclient.h"
+
+ /**
+ * @brief waits for a semaphore, asks conn->interrupted on signals
+ * @param conn the connection
+ * @param sem semaphore to wait on
+ * @param description set as error if waiting fails
+ * @return 0 on success, -1 on error or shutdown of the server
+ */
+static int wait_sem(AuthConn *conn, sem_t *sem, const char *description);
+
+ /**
+ * @brief reads or writes exactly len bytes on the socket
+ * @param conn the connection
+ * @param buf the buffer
+ * @param len number of bytes
+ * @param writing 1 to write, 0 to read
+ * @return 0 on success, -1 on error with conn->error set
+ */
+static int transfer(AuthConn *conn, void *buf, size_t len, int writing);
+
+ /**
+ * @brief claims a free slot by swapping in the pid of this process as owner
+ * @param conn a shm connection
+ * @return the slot with a cleared request, NULL if no slot is free
+ */
+static MyShm *claim_slot(AuthConn *conn);
+
+ /**
+ * @brief marks a filled slot ready and wakes the server if it sleeps
+ * @param conn a shm connection
+ * @param slot the claimed slot holding the request
+ * @return 0 on success, -1 on error with conn->error set
+ */
+static int hand_over(AuthConn *conn, MyShm *slot);
+
+ /**
+ * @brief checks after a wakeup whether the server shut down
+ * @param conn a shm connection
+ * @return 0 if it still runs, -1 with conn->error set otherwise
+ */
+static int check_shutdown(AuthConn *conn);
+
+ /**
+ * @brief writes as many queued request frames as the socket takes
+ * @param queue a socket queue
+ * @return 0 on success, -1 on error with conn->error set
+ */
+static int queue_flush(AuthQueue *queue);
+
+ /**
+ * @brief reads what the socket has and turns complete frames into completions
+ * @param queue a socket queue
+ * @param completions filled with the finished requests
+ * @param max size of completions
+ * @return number of completions filled, -1 on error with conn->error set
+ */
+static int queue_read(AuthQueue *queue, AuthCompletion *completions, int max);
+
+ /**
+ * @brief takes the replies the server posted and frees their slots
+ * @param queue a shm queue
+ * @param completions filled with the finished requests
+ * @param max size of completions
+ * @return number of completions filled, -1 on error with conn->error set
+ */
+static int queue_reap(AuthQueue *queue, AuthCompletion *completions, int max);
+
+ /**
+ * @brief the notifier thread of a shm queue
+ * @param arg the queue
+ */
+static void *queue_notifier(void *arg);
+
+void auth_init(AuthConn *conn, AuthInterrupted interrupted){
+	(void)memset(conn, 0, sizeof(AuthConn));
+	conn->shmfd = -1;
+	conn->sock = -1;
+	conn->s_sem = SEM_FAILED;
+	conn->c_w_sem = SEM_FAILED;
+	conn->interrupted = interrupted;
+}
+
+int auth_open_shm(AuthConn *conn){
+	struct stat st;
+	MySegment *shared;
+	conn->shmfd = shm_open(SHM_NAME, O_RDWR, PERMISSION);
+	if(conn->shmfd == -1){
+		conn->error = "couldnt open shared memory";
+		return -1;
+	}
+	if(fstat(conn->shmfd, &st) == -1){
+		conn->error = "couldnt stat shared memory";
+		return -1;
+	}
+	if(st.st_size < (off_t)sizeof *shared){
+		conn->error = "shared memory is too small, server uses another layout";
+		return -1;
+	}
+	shared = mmap(NULL, sizeof *shared, PROT_READ | PROT_WRITE, MAP_SHARED, conn->shmfd, 0);
+	if(shared == MAP_FAILED){
+		conn->error = "couldnt map shared memory";
+		return -1;
+	}
+	conn->shared = shared;
+	conn->pid = getpid();
+	if(shared->header.magic != SHM_MAGIC){
+		conn->error = "server not ready";
+		return -1;
+	}
+	__sync_synchronize();
+	if(shared->header.layout != SHM_LAYOUT_VERSION || shared->header.size != sizeof *shared
+		|| shared->header.slots != SHM_SLOTS || shared->header.slotSize != sizeof(MyShm)
+		|| shared->header.page != SHM_PAGE || shared->header.loginLen != LOGIN_LEN
+		|| shared->header.passLen != PASS_LEN || shared->header.secretLen != SECRET_LEN){
+		conn->error = "server uses an incompatible shared memory layout";
+		return -1;
+	}
+	
+	//initialize semaphors
+	conn->s_sem = sem_open(SERVER_SEM, 0);
+	if(conn->s_sem == SEM_FAILED){
+		conn->error = "opening server sem failed!";
+		return -1;
+	}
+	conn->c_w_sem = sem_open(CLIENT_WRITE_SEM, 0);
+	if(conn->c_w_sem == SEM_FAILED){
+		conn->error = "opening client write sem failed!";
+		return -1;
+	}
+	return 0;
+}
+
+int auth_open_socket(AuthConn *conn, const char *path){
+	struct sockaddr_un addr;
+	if(strlen(path) >= sizeof(addr.sun_path)){
+		conn->error = "socket path too long";
+		return -1;
+	}
+	(void)memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	(void)strcpy(addr.sun_path, path);
+	conn->sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(conn->sock == -1){
+		conn->error = "couldnt create socket";
+		return -1;
+	}
+	if(connect(conn->sock, (struct sockaddr*)&addr, sizeof(addr)) == -1){
+		conn->error = "couldnt connect to server socket";
+		return -1;
+	}
+	return 0;
+}
+
+void auth_close(AuthConn *conn){
+	if(conn->sock != -1){
+		(void)close(conn->sock);
+		conn->sock = -1;
+	}
+	if(conn->shared != NULL){
+		(void)munmap(conn->shared, sizeof *conn->shared);
+		conn->shared = NULL;
+	}
+	if(conn->shmfd != -1){
+		(void)close(conn->shmfd);
+		conn->shmfd = -1;
+	}
+	if(conn->s_sem != SEM_FAILED){
+		(void)sem_close(conn->s_sem);
+		conn->s_sem = SEM_FAILED;
+	}
+	if(conn->c_w_sem != SEM_FAILED){
+		(void)sem_close(conn->c_w_sem);
+		conn->c_w_sem = SEM_FAILED;
+	}
+}
+
+MyShm *auth_claim(AuthConn *conn){
+	MyShm *slot;
+	TRACE_BEGIN(begin);
+	if(conn->sock != -1){
+		(void)memset(&conn->local.req, 0, sizeof(MyRequest));
+		conn->local.req.seq = ++conn->sequence;
+		return &conn->local;
+	}
+	for(;;){
+		if(check_shutdown(conn) == -1){
+			return NULL;
+		}
+		if((slot = claim_slot(conn)) != NULL){
+			break;
+		}
+		//counted before the second look, so a slot freed after it posts for us
+		(void)__sync_fetch_and_add(&conn->shared->slotWaiters,1);
+		slot = claim_slot(conn);
+		if(slot == NULL && wait_sem(conn, conn->c_w_sem, "client write sem") == -1){
+			(void)__sync_fetch_and_sub(&conn->shared->slotWaiters,1);
+			return NULL;
+		}
+		(void)__sync_fetch_and_sub(&conn->shared->slotWaiters,1);
+		if(slot != NULL){
+			break;
+		}
+	}
+	TRACE_END("claim",begin,-1);
+	return slot;
+}
+
+int auth_submit(AuthConn *conn, MyShm *slot){
+	TRACE_BEGIN(begin);
+	if(conn->sock != -1){
+		if(auth_send(conn, &slot->req) == -1 || auth_recv(conn, &slot->resp) == -1){
+			return -1;
+		}
+	}else{
+		if(hand_over(conn, slot) == -1){
+			return -1;
+		}
+		TRACE_BEGIN(waitBegin);
+		if(wait_sem(conn, &slot->done, "client read sem") == -1){
+			return -1;
+		}
+		__sync_synchronize();
+		TRACE_END("wait_reply",waitBegin,slot->req.command);
+	}
+	if(slot->resp.seq != slot->req.seq){
+		conn->error = "reply does not belong to the request";
+		return -1;
+	}
+	TRACE_END("request",begin,slot->req.command);
+	return 0;
+}
+
+int auth_release(AuthConn *conn, MyShm *slot){
+	if(conn->sock != -1){
+		return 0;
+	}
+	__sync_synchronize();
+	slot->phase = SLOT_FREE;
+	__sync_synchronize();
+	slot->owner = 0;
+	__sync_synchronize();
+	if(conn->shared->slotWaiters > 0 && sem_post(conn->c_w_sem)!=0){
+		conn->error = "client write semaphore error";
+		return -1;
+	}
+	return 0;
+}
+
+int auth_send(AuthConn *conn, MyRequest *req){
+	char frame[FRAME_HEADER + REQUEST_FRAME_SIZE];
+	uint32_t len = REQUEST_FRAME_SIZE;
+	(void)memcpy(frame, &len, FRAME_HEADER);
+	(void)memcpy(frame + FRAME_HEADER, req, REQUEST_FRAME_SIZE);
+	return transfer(conn, frame, sizeof(frame), 1);
+}
+
+int auth_recv(AuthConn *conn, MyResponse *resp){
+	uint32_t len;
+	if(transfer(conn, &len, FRAME_HEADER, 0) == -1){
+		return -1;
+	}
+	if(len < offsetof(MyResponse,page)+1 || len > sizeof(MyResponse)){
+		conn->error = "malformed reply frame";
+		return -1;
+	}
+	if(transfer(conn, resp, len, 0) == -1){
+		return -1;
+	}
+	resp->page[len - offsetof(MyResponse,page) - 1] = '\0';
+	return 0;
+}
+
+static int transfer(AuthConn *conn, void *buf, size_t len, int writing){
+	char *pos = (char*) buf;
+	while(len > 0){
+		ssize_t done = writing ? write(conn->sock, pos, len) : read(conn->sock, pos, len);
+		if(done == -1){
+			if(errno == EINTR && (conn->interrupted == NULL || !conn->interrupted())){
+				continue;
+			}
+			conn->error = writing ? "couldnt write to server socket" : "couldnt read from server socket";
+			return -1;
+		}
+		if(done == 0){
+			conn->shutdown = 1;
+			conn->error = "server has shut down, closing";
+			return -1;
+		}
+		pos += done;
+		len -= done;
+	}
+	return 0;
+}
+
+static int wait_sem(AuthConn *conn, sem_t *sem, const char *description){
+	while((sem_wait(sem))==-1){
+			if(errno == EINTR){
+				if(conn->interrupted != NULL && conn->interrupted()){
+					conn->error = "interrupted";
+					return -1;
+				}
+			}else{
+				conn->error = description;
+				return -1;
+			}
+	}
+	return check_shutdown(conn);
+}
+
+static int check_shutdown(AuthConn *conn){
+	if(conn->shared->state==-1){
+		//pass the wakeup on to the next waiting client
+		(void)sem_post(conn->c_w_sem);
+		conn->shutdown = 1;
+		conn->error = "server has shut down, closing";
+		return -1;
+	}
+	return 0;
+}
+
+static MyShm *claim_slot(AuthConn *conn){
+	int i;
+	for(i=0;i<SHM_SLOTS;i++){
+		if(__sync_bool_compare_and_swap(&conn->shared->slot[i].owner,0,conn->pid)){
+			MyShm *slot = &conn->shared->slot[i];
+			slot->claimed = trace_now();
+			slot->phase = SLOT_CLAIMED;
+			(void)memset(&slot->req, 0, sizeof(MyRequest));
+			slot->req.seq = ++conn->sequence;
+			return slot;
+		}
+	}
+	return NULL;
+}
+
+static int hand_over(AuthConn *conn, MyShm *slot){
+	MySegment *shared = conn->shared;
+	__sync_synchronize();
+	slot->phase = SLOT_READY;
+	if(__sync_bool_compare_and_swap(&shared->sleeping,1,0)){
+		if(sem_post(conn->s_sem)!=0){
+			conn->error = "server semaphore error";
+			return -1;
+		}
+		(void)__sync_fetch_and_add(&shared->clientStats.client_wakeup_posts,1);
+	}else{
+		(void)__sync_fetch_and_add(&shared->clientStats.client_wakeup_skips,1);
+	}
+	return 0;
+}
+
+int auth_queue_init(AuthQueue *queue, AuthConn *conn){
+	(void)memset(queue, 0, offsetof(AuthQueue,out));
+	queue->conn = conn;
+	queue->notify = -1;
+	queue->outUsed = 0;
+	queue->outSent = 0;
+	queue->inUsed = 0;
+	if(conn->sock != -1){
+		int flags = fcntl(conn->sock, F_GETFL);
+		if(flags == -1 || fcntl(conn->sock, F_SETFL, flags | O_NONBLOCK) == -1){
+			conn->error = "couldnt make the server socket non blocking";
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int auth_queue_submit(AuthQueue *queue, const MyRequest *req, void *userData){
+	AuthConn *conn = queue->conn;
+	AuthPending *pending;
+	if(queue->count == AUTH_QUEUE_DEPTH){
+		return 1;
+	}
+	pending = &queue->pending[(queue->head+queue->count)%AUTH_QUEUE_DEPTH];
+	(void)memset(pending, 0, sizeof(AuthPending));
+	pending->userData = userData;
+	if(conn->sock != -1){
+		uint32_t len = REQUEST_FRAME_SIZE;
+		MyRequest *frame;
+		if(queue->outSent == queue->outUsed){
+			queue->outSent = 0;
+			queue->outUsed = 0;
+		}else if(queue->outUsed + FRAME_HEADER + REQUEST_FRAME_SIZE > sizeof(queue->out)){
+			(void)memmove(queue->out, queue->out + queue->outSent, queue->outUsed - queue->outSent);
+			queue->outUsed -= queue->outSent;
+			queue->outSent = 0;
+		}
+		(void)memcpy(queue->out + queue->outUsed, &len, FRAME_HEADER);
+		frame = (MyRequest*) (queue->out + queue->outUsed + FRAME_HEADER);
+		(void)memcpy(frame, req, REQUEST_FRAME_SIZE);
+		frame->seq = ++conn->sequence;
+		pending->seq = frame->seq;
+		queue->outUsed += FRAME_HEADER + REQUEST_FRAME_SIZE;
+		queue->count++;
+		queue->submits++;
+		return queue_flush(queue);
+	}
+	if(check_shutdown(conn) == -1){
+		return -1;
+	}
+	//the queue never waits for a slot, it rather lets the caller collect replies
+	if((pending->slot = claim_slot(conn)) == NULL){
+		return 1;
+	}
+	pending->seq = pending->slot->req.seq;
+	(void)memcpy(&pending->slot->req, req, sizeof(MyRequest));
+	pending->slot->req.seq = pending->seq;
+	queue->count++;
+	queue->submits++;
+	if(queue->notify != -1 && sem_post(&queue->submitted) == -1){
+		conn->error = "couldnt wake the notifier";
+		return -1;
+	}
+	return hand_over(conn, pending->slot);
+}
+
+int auth_queue_poll(AuthQueue *queue, AuthCompletion *completions, int max){
+	if(queue->conn->sock != -1){
+		if(queue_flush(queue) == -1){
+			return -1;
+		}
+		return queue_read(queue, completions, max);
+	}
+	return queue_reap(queue, completions, max);
+}
+
+int auth_queue_wait(AuthQueue *queue, AuthCompletion *completions, int max, long long timeout){
+	AuthConn *conn = queue->conn;
+	long long deadline = timeout < 0 ? -1 : trace_now() + timeout;
+	for(;;){
+		int got = auth_queue_poll(queue, completions, max);
+		long long left = deadline < 0 ? -1 : deadline - trace_now();
+		if(got != 0 || max <= 0 || queue->count == 0 || (deadline >= 0 && left <= 0)){
+			return got;
+		}
+		if(conn->sock != -1 || queue->notify != -1){
+			struct pollfd pfd;
+			pfd.fd = auth_queue_fd(queue, &pfd.events);
+			//rounded up so a short timeout still waits
+			if(poll(&pfd, 1, left < 0 ? -1 : (int)((left+999999)/1000000)) == -1 && errno != EINTR){
+				conn->error = "couldnt poll the queue";
+				return -1;
+			}
+		}else{
+			//the server finishes all ready slots in one pass, so the oldest is the one to wait for
+			AuthPending *oldest = &queue->pending[queue->head];
+			int result;
+			if(left < 0){
+				result = sem_wait(&oldest->slot->done);
+			}else{
+				struct timespec until;
+				if(clock_gettime(CLOCK_REALTIME, &until) == -1){
+					conn->error = "couldnt read the clock";
+					return -1;
+				}
+				until.tv_sec += (until.tv_nsec + left) / 1000000000LL;
+				until.tv_nsec = (until.tv_nsec + left) % 1000000000LL;
+				result = sem_timedwait(&oldest->slot->done, &until);
+			}
+			if(result == 0){
+				oldest->replied = 1;
+			}else if(errno == EINTR){
+				if(conn->interrupted != NULL && conn->interrupted()){
+					conn->error = "interrupted";
+					return -1;
+				}
+			}else if(errno != ETIMEDOUT){
+				conn->error = "client read sem";
+				return -1;
+			}
+		}
+	}
+}
+
+int auth_queue_fd(AuthQueue *queue, short *events){
+	AuthConn *conn = queue->conn;
+	if(conn->sock == -1){
+		*events = POLLIN;
+		if(queue->notify != -1){
+			return queue->notify;
+		}
+		if(sem_init(&queue->submitted, 0, queue->count) == -1){
+			conn->error = "couldnt create the notifier semaphore";
+			return -1;
+		}
+		if((queue->notify = eventfd(0, EFD_NONBLOCK)) == -1){
+			(void)sem_destroy(&queue->submitted);
+			conn->error = "couldnt create the notifier eventfd";
+			return -1;
+		}
+		//requests already in flight are waited for from the oldest on
+		queue->notified = queue->submits - queue->count;
+		if(pthread_create(&queue->notifier, NULL, queue_notifier, queue) != 0){
+			(void)close(queue->notify);
+			queue->notify = -1;
+			(void)sem_destroy(&queue->submitted);
+			conn->error = "couldnt start the notifier";
+			return -1;
+		}
+		return queue->notify;
+	}
+	*events = POLLIN;
+	if(queue->outSent < queue->outUsed){
+		*events |= POLLOUT;
+	}
+	return queue->conn->sock;
+}
+
+void auth_queue_close(AuthQueue *queue){
+	if(queue->notify != -1){
+		//it only waits for the next submission then, which never comes
+		(void)pthread_cancel(queue->notifier);
+		(void)pthread_join(queue->notifier, NULL);
+		(void)sem_destroy(&queue->submitted);
+		(void)close(queue->notify);
+		queue->notify = -1;
+	}
+}
+
+static int queue_flush(AuthQueue *queue){
+	AuthConn *conn = queue->conn;
+	while(queue->outSent < queue->outUsed){
+		ssize_t done = write(conn->sock, queue->out + queue->outSent, queue->outUsed - queue->outSent);
+		if(done == -1){
+			if(errno == EINTR){
+				continue;
+			}
+			if(errno == EAGAIN || errno == EWOULDBLOCK){
+				return 0;
+			}
+			conn->error = "couldnt write to server socket";
+			return -1;
+		}
+		queue->outSent += done;
+	}
+	return 0;
+}
+
+static int queue_read(AuthQueue *queue, AuthCompletion *completions, int max){
+	AuthConn *conn = queue->conn;
+	int got = 0;
+	for(;;){
+		size_t pos = 0;
+		ssize_t done;
+		while(got < max && queue->inUsed - pos >= FRAME_HEADER){
+			AuthPending *pending = &queue->pending[queue->head];
+			MyResponse *resp = &completions[got].resp;
+			uint32_t len;
+			(void)memcpy(&len, queue->in + pos, FRAME_HEADER);
+			if(len < offsetof(MyResponse,page)+1 || len > sizeof(MyResponse)){
+				conn->error = "malformed reply frame";
+				return -1;
+			}
+			if(queue->inUsed - pos < FRAME_HEADER + len){
+				break;
+			}
+			if(queue->count == 0){
+				conn->error = "reply without a request";
+				return -1;
+			}
+			(void)memcpy(resp, queue->in + pos + FRAME_HEADER, len);
+			resp->page[len - offsetof(MyResponse,page) - 1] = '\0';
+			if(resp->seq != pending->seq){
+				conn->error = "reply does not belong to the request";
+				return -1;
+			}
+			completions[got++].userData = pending->userData;
+			queue->head = (queue->head+1)%AUTH_QUEUE_DEPTH;
+			queue->count--;
+			pos += FRAME_HEADER + len;
+		}
+		(void)memmove(queue->in, queue->in + pos, queue->inUsed - pos);
+		queue->inUsed -= pos;
+		if(got == max || queue->count == 0){
+			return got;
+		}
+		done = read(conn->sock, queue->in + queue->inUsed, sizeof(queue->in) - queue->inUsed);
+		if(done == -1){
+			if(errno == EINTR){
+				continue;
+			}
+			if(errno == EAGAIN || errno == EWOULDBLOCK){
+				return got;
+			}
+			conn->error = "couldnt read from server socket";
+			return -1;
+		}
+		if(done == 0){
+			conn->shutdown = 1;
+			conn->error = "server has shut down, closing";
+			return -1;
+		}
+		queue->inUsed += done;
+	}
+}
+
+static int queue_reap(AuthQueue *queue, AuthCompletion *completions, int max){
+	AuthConn *conn = queue->conn;
+	int got = 0;
+	unsigned int i;
+	if(queue->notify != -1){
+		uint64_t events;
+		//replies marked after this read signal the eventfd again
+		(void)read(queue->notify, &events, sizeof(events));
+	}
+	for(i=0;i<queue->count && got<max;i++){
+		AuthPending *pending = &queue->pending[(queue->head+i)%AUTH_QUEUE_DEPTH];
+		MyResponse *resp = &completions[got].resp;
+		if(pending->done){
+			continue;
+		}
+		if(!pending->replied){
+			if(queue->notify != -1){
+				continue;
+			}
+			if(sem_trywait(&pending->slot->done) == -1){
+				if(errno == EAGAIN || errno == EINTR){
+					continue;
+				}
+				conn->error = "client read sem";
+				return -1;
+			}
+			pending->replied = 1;
+		}
+		__sync_synchronize();
+		if(check_shutdown(conn) == -1){
+			return -1;
+		}
+		(void)memcpy(resp, &pending->slot->resp, RESPONSE_FRAME_SIZE(&pending->slot->resp));
+		if(resp->seq != pending->seq){
+			conn->error = "reply does not belong to the request";
+			return -1;
+		}
+		if(auth_release(conn, pending->slot) == -1){
+			return -1;
+		}
+		completions[got++].userData = pending->userData;
+		pending->done = 1;
+	}
+	//finished requests only leave the ring from its oldest end
+	while(queue->count > 0 && queue->pending[queue->head].done){
+		queue->head = (queue->head+1)%AUTH_QUEUE_DEPTH;
+		queue->count--;
+	}
+	return got;
+}
+
+static void *queue_notifier(void *arg){
+	AuthQueue *queue = (AuthQueue*) arg;
+	uint64_t one = 1;
+	for(;;){
+		AuthPending *pending;
+		while(sem_wait(&queue->submitted) == -1){
+			if(errno != EINTR){
+				return NULL;
+			}
+		}
+		pending = &queue->pending[queue->notified++ % AUTH_QUEUE_DEPTH];
+		//taken by the caller before the notifier started
+		if(!pending->replied){
+			while(sem_wait(&pending->slot->done) == -1){
+				if(errno != EINTR){
+					return NULL;
+				}
+			}
+			__sync_synchronize();
+			pending->replied = 1;
+		}
+		if(write(queue->notify, &one, sizeof(one)) == -1){
+			return NULL;
+		}
+	}
+}
@@ -0,0 +1,218 @@
+#ifndef myauthclientlib
+#define myauthclientlib
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include "myshared.h"
+#include "trace.h"
+
+ /*
+ * called when a wait was interrupted by a signal, returns nonzero to give up
+ */
+typedef int (*AuthInterrupted)(void);
+
+ /*
+ * one connection to the server, either through the shm slots or a unix socket.
+ * through the socket the request and reply live in local instead of a slot
+ */
+typedef struct myauthconnstruct {
+	MySegment *shared;
+	int shmfd;
+	sem_t *s_sem;
+	sem_t *c_w_sem;
+	int sock;
+	MyShm local;
+	pid_t pid;
+	unsigned int sequence;
+	int shutdown;
+	const char *error;
+	AuthInterrupted interrupted;
+} AuthConn;
+
+//requests an AuthQueue keeps in flight at most, the shm transport is also bound by its free slots
+#define AUTH_QUEUE_DEPTH (64)
+
+ /*
+ * a finished request of an AuthQueue, resp is only valid up to the end of its page
+ */
+typedef struct myauthcompletionstruct {
+	void *userData;
+	MyResponse resp;
+} AuthCompletion;
+
+ /*
+ * a submitted request that was not handed out yet. replied is set once the
+ * reply semaphore of its slot was taken, by the notifier while there is one,
+ * slot is NULL on the socket
+ */
+typedef struct myauthpendingstruct {
+	void *userData;
+	unsigned int seq;
+	MyShm *slot;
+	volatile int replied;
+	int done;
+} AuthPending;
+
+ /*
+ * requests in flight on one connection, pending is a ring in submission order,
+ * the n-th submitted request sits at pending[n % AUTH_QUEUE_DEPTH].
+ * through the socket requests wait in out until the socket takes them and
+ * replies are gathered in in until their frame is complete.
+ * on shm a notifier thread is started once an fd is asked for, it waits for
+ * the replies in submission order, one post of submitted per request, and
+ * signals each one on the eventfd notify
+ */
+typedef struct myauthqueuestruct {
+	AuthConn *conn;
+	AuthPending pending[AUTH_QUEUE_DEPTH];
+	unsigned int head;
+	unsigned int count;
+	unsigned int submits;
+	unsigned int notified;
+	int notify;
+	pthread_t notifier;
+	sem_t submitted;
+	char out[AUTH_QUEUE_DEPTH*(FRAME_HEADER+REQUEST_FRAME_SIZE)];
+	size_t outUsed;
+	size_t outSent;
+	char in[2*(FRAME_HEADER+sizeof(MyResponse))];
+	size_t inUsed;
+} AuthQueue;
+
+ /**
+ * @brief puts a connection into the closed state
+ * @param conn the connection
+ * @param interrupted called on EINTR, NULL to retry silently
+ */
+void auth_init(AuthConn *conn, AuthInterrupted interrupted);
+
+ /**
+ * @brief attaches to the shared segment of the server and checks its layout
+ * @param conn the connection
+ * @return 0 on success, -1 on error with conn->error set
+ */
+int auth_open_shm(AuthConn *conn);
+
+ /**
+ * @brief connects to the unix socket of the server
+ * @param conn the connection
+ * @param path path of the socket
+ * @return 0 on success, -1 on error with conn->error set
+ */
+int auth_open_socket(AuthConn *conn, const char *path);
+
+ /**
+ * @brief closes whatever the connection has open
+ * @param conn the connection
+ */
+void auth_close(AuthConn *conn);
+
+ /**
+ * @brief waits for a free slot and claims it
+ * @param conn the connection
+ * @return the slot with a cleared request, NULL on error with conn->error set
+ */
+MyShm *auth_claim(AuthConn *conn);
+
+ /**
+ * @brief hands the filled slot to the server and waits for the reply
+ * @param conn the connection
+ * @param slot the claimed slot holding the request
+ * @return 0 on success, -1 on error with conn->error set
+ */
+int auth_submit(AuthConn *conn, MyShm *slot);
+
+ /**
+ * @brief gives the slot back after the reply was read
+ * @param conn the connection
+ * @param slot the slot to free
+ * @return 0 on success, -1 on error with conn->error set
+ */
+int auth_release(AuthConn *conn, MyShm *slot);
+
+ /**
+ * @brief writes one request frame to the socket without waiting for the reply
+ * @param conn a socket connection
+ * @param req the request
+ * @return 0 on success, -1 on error with conn->error set
+ */
+int auth_send(AuthConn *conn, MyRequest *req);
+
+ /**
+ * @brief reads the next reply frame from the socket
+ * @param conn a socket connection
+ * @param resp the reply to fill
+ * @return 0 on success, -1 on error with conn->error set
+ */
+int auth_recv(AuthConn *conn, MyResponse *resp);
+
+ /**
+ * @brief sets up a queue of requests in flight on an open connection
+ * @details a socket becomes non blocking, from then on the connection
+ *          may only be used through the queue
+ * @param queue the queue
+ * @param conn the open connection
+ * @return 0 on success, -1 on error with conn->error set
+ */
+int auth_queue_init(AuthQueue *queue, AuthConn *conn);
+
+ /**
+ * @brief hands a request to the server without waiting for anything
+ * @param queue the queue
+ * @param req the request, its seq is assigned by the queue
+ * @param userData returned with the completion of the request
+ * @return 0 if submitted, 1 if the queue or the slots are full and
+ *         completions have to be collected first, -1 on error with conn->error set
+ */
+int auth_queue_submit(AuthQueue *queue, const MyRequest *req, void *userData);
+
+ /**
+ * @brief collects finished requests without blocking
+ * @details socket replies arrive in submission order, shm replies in the
+ *          order the server finished them
+ * @param queue the queue
+ * @param completions filled with the finished requests
+ * @param max size of completions
+ * @return number of completions filled, -1 on error with conn->error set
+ */
+int auth_queue_poll(AuthQueue *queue, AuthCompletion *completions, int max);
+
+ /**
+ * @brief collects finished requests, blocking until there is at least one
+ * @param queue the queue
+ * @param completions filled with the finished requests
+ * @param max size of completions
+ * @param timeout ns to wait at most, negative to wait for good
+ * @return number of completions filled, 0 on timeout or if nothing is in flight,
+ *         -1 on error with conn->error set
+ */
+int auth_queue_wait(AuthQueue *queue, AuthCompletion *completions, int max, long long timeout);
+
+ /**
+ * @brief file descriptor to wait on with poll or epoll before auth_queue_poll
+ * @details on shm the first call starts a thread that turns replies into
+ *          events of an eventfd, without it the queue waits on the slots directly
+ * @param queue the queue
+ * @param events set to the poll events to wait for
+ * @return the socket or the eventfd, -1 on error with conn->error set
+ */
+int auth_queue_fd(AuthQueue *queue, short *events);
+
+ /**
+ * @brief stops the notifier of a queue, call once nothing is in flight
+ * @param queue the queue
+ */
+void auth_queue_close(AuthQueue *queue);
+
+#endif
@@ -0,0 +1,606 @@
+/**
+ * @file bench.c
+ * @author David Schrder 1226747
+ * @brief Microbenchmarks for the auth server storage
+ * @details Sweeps the number of users and sessions and reports ns/op of the
+ *          db.c operations and bytes per record, optionally compared to a
+ *          baseline written by an earlier run. With -e it instead measures
+ *          requests against a running server over shm and the unix socket
+ * @date 08.01.2017
+ */
+#include "bench.h"
+  /**
+ * @brief Parse command line options
+ * @param argc The argument counter
+ * @param argv The argument vector
+ */
+static void parse_args(int argc, char **argv);
+
+ /**
+ * @brief exit with an error message
+ * @param exitcode the exitcode to return
+ * @param errmsg message to print before exiting
+ */
+static void bailout(int exitcode, const char *errmsg);
+
+ /**
+ * @brief runs a benchmark body with growing op counts until the time budget is used
+ * @param body the benchmark body, runs the given number of ops
+ * @return nanoseconds per op
+ */
+static double measure(void (*body)(long ops));
+
+ /**
+ * @brief records a result, prints it and compares it to the baseline
+ * @param name name of the benchmark
+ * @param n number of users or sessions it ran with
+ * @param value the measured value
+ * @param unit unit printed after the value
+ */
+static void report(const char *name, unsigned int n, double value, const char *unit);
+
+ /**
+ * @brief currently allocated heap bytes
+ */
+static long heap_used(void);
+
+ /**
+ * @brief writes a short unique name for a number, fits every width the bench builds with
+ * @param name buffer of at least BENCH_NAME_LEN bytes
+ * @param tag first character, keeps the kinds of names apart
+ * @param i the number
+ */
+static void bench_name(char *name, char tag, unsigned int i);
+
+ /**
+ * @brief builds a db with n users, measures insert time and memory per user
+ * @param n number of users
+ */
+static void build_db(unsigned int n);
+
+ /**
+ * @brief builds n sessions, measures insert time and memory per session
+ * @param n number of sessions
+ */
+static void build_sessions(unsigned int n);
+
+ /**
+ * @brief frees the db and sessions of the current size
+ */
+static void free_db(void);
+
+ /**
+ * @brief reads the baseline file into the baseline table
+ * @param path the file to read
+ */
+static void read_baseline(const char *path);
+
+ /**
+ * @brief writes all results to the baseline file
+ * @param path the file to write
+ */
+static void write_baseline(const char *path);
+
+ /**
+ * @brief measures READ_SECRET round trips against a running server
+ * @details shm and socket one request at a time, then both with
+ *          depth requests in flight through an AuthQueue
+ */
+static void bench_transports(void);
+
+ /**
+ * @brief sends one request and waits for the reply, exits on any error
+ * @param conn the connection
+ * @param command the command
+ * @param login login to send
+ * @param sessId session to send
+ * @return state of the reply
+ */
+static int e2e_request(AuthConn *conn, int command, char *login, int sessId);
+
+ /**
+ * @brief times requests sync requests of READ_SECRET on the connection
+ * @param conn the connection
+ * @param name name to report
+ * @param login the logged in user
+ * @param sessId its session
+ */
+static void e2e_sync(AuthConn *conn, const char *name, char *login, int sessId);
+
+ /**
+ * @brief times requests READ_SECRETs with up to depth of them in flight
+ * @param conn the connection, only used through a queue afterwards
+ * @param name name to report
+ * @param login the logged in user
+ * @param sessId its session
+ * @param withFd 1 to wait with poll on the fd of the queue, 0 to use auth_queue_wait
+ */
+static void e2e_pipelined(AuthConn *conn, const char *name, char *login, int sessId, int withFd);
+
+static void body_search_hit(long ops);
+static void body_search_miss(long ops);
+static void body_get_session(long ops);
+static void body_new_session_id(long ops);
+
+ /*
+ * the programs name
+ */
+static char *myname;
+
+static unsigned int maxUsers = BENCH_DEFAULT_MAX;
+static char *cpuList;
+static int numaNode = -1;
+static char *baselinePath;
+static char *writePath;
+static int e2eMode;
+static char *sockPath;
+static unsigned int requests = BENCH_DEFAULT_REQUESTS;
+static unsigned int depth = BENCH_DEFAULT_DEPTH;
+
+static BenchResult results[BENCH_RESULTS];
+
+ /*
+ * requests in flight of e2e_pipelined and the completions it collects at once
+ */
+static AuthQueue queue;
+static AuthCompletion completions[AUTH_QUEUE_DEPTH];
+static int resultCount;
+static BenchResult baseline[BENCH_RESULTS];
+static int baselineCount;
+
+ /*
+ * data of the size currently measured
+ */
+static UserStore store;
+static SessionTable sessions;
+static int *sessionIds;
+static unsigned int size;
+
+ /*
+ * keeps the compiler from dropping the measured calls
+ */
+static volatile long sink;
+
+/**
+ * @brief Program entry point
+ * @param argc The argument counter
+ * @param argv The argument vector
+ * @details runs every benchmark for 100, 1000, ... users up to the maximum
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on error or false parameters
+ */
+int main(int argc, char **argv){
+	char csvPath[] = "/tmp/auth-bench.XXXXXX";
+	int fd;
+	unsigned int n;
+	parse_args(argc,argv);
+	if(cpuList != NULL && placement_pin(cpuList)==-1){
+		bailout(EXIT_FAILURE,"couldnt pin to the given cpus");
+	}
+	if(numaNode >= 0 && placement_node(numaNode)==-1){
+		bailout(EXIT_FAILURE,"couldnt bind memory to the given numa node");
+	}
+	placement_report_process(stdout,"auth-bench");
+	if(baselinePath != NULL){
+		read_baseline(baselinePath);
+	}
+	if(e2eMode){
+		bench_transports();
+		if(writePath != NULL){
+			write_baseline(writePath);
+		}
+		return EXIT_SUCCESS;
+	}
+	fd = mkstemp(csvPath);
+	if(fd == -1){
+		bailout(EXIT_FAILURE,"couldnt create temporary csv file");
+	}
+	(void)close(fd);
+	srand(1226747);
+	(void)fprintf(stdout,"%-16s %8s %14s\n","benchmark","n","result");
+	for(n=100;n<=maxUsers;n*=10){
+		const char *errmsg;
+		long long begin;
+		size = n;
+		build_db(n);
+		report("search_for_hit",n,measure(body_search_hit),"ns/op");
+		report("search_for_miss",n,measure(body_search_miss),"ns/op");
+
+		begin = trace_now();
+		if(dumpdb(&store,csvPath)==-1){
+			bailout(EXIT_FAILURE,"dumpdb failed");
+		}
+		report("dumpdb",n,(double)(trace_now()-begin)/n,"ns/user");
+		free_db();
+
+		begin = trace_now();
+		if(load_db(&store,csvPath,&errmsg)==-1){
+			bailout(EXIT_FAILURE,errmsg);
+		}
+		report("load_db",n,(double)(trace_now()-begin)/n,"ns/user");
+		free_db();
+
+		build_sessions(n);
+		report("get_session",n,measure(body_get_session),"ns/op");
+		report("new_session_id",n,measure(body_new_session_id),"ns/op");
+		free_db();
+	}
+	(void)unlink(csvPath);
+	if(writePath != NULL){
+		write_baseline(writePath);
+	}
+	return EXIT_SUCCESS;
+}
+
+static void bench_transports(void){
+	AuthConn shm;
+	AuthConn sock;
+	char login[LOGIN_LEN];
+	int sessId;
+	auth_init(&shm,NULL);
+	auth_init(&sock,NULL);
+	if(auth_open_shm(&shm)==-1){
+		bailout(EXIT_FAILURE,shm.error);
+	}
+	bench_name(login,'b',(unsigned int)getpid());
+	if(e2e_request(&shm,REGISTER,login,0)!=STATE_OK){
+		bailout(EXIT_FAILURE,"couldnt register the bench user");
+	}
+	if(e2e_request(&shm,LOGIN,login,0)!=STATE_OK){
+		bailout(EXIT_FAILURE,"couldnt login the bench user");
+	}
+	sessId = shm.local.resp.sessId;
+	(void)fprintf(stdout,"%-16s %8s %14s\n","benchmark","depth","result");
+	e2e_sync(&shm,"shm_read_secret",login,sessId);
+	e2e_pipelined(&shm,"shm_pipelined",login,sessId,0);
+	e2e_pipelined(&shm,"shm_pipelined_fd",login,sessId,1);
+	if(sockPath != NULL){
+		if(auth_open_socket(&sock,sockPath)==-1){
+			bailout(EXIT_FAILURE,sock.error);
+		}
+		e2e_sync(&sock,"sock_read_secret",login,sessId);
+		e2e_pipelined(&sock,"sock_pipelined",login,sessId,0);
+		auth_close(&sock);
+	}
+	(void)e2e_request(&shm,LOGOUT,login,sessId);
+	auth_close(&shm);
+}
+
+static int e2e_request(AuthConn *conn, int command, char *login, int sessId){
+	MyShm *slot = auth_claim(conn);
+	if(slot == NULL){
+		bailout(EXIT_FAILURE,conn->error);
+	}
+	slot->req.command = command;
+	slot->req.sessId = sessId;
+	mystrcpy(slot->req.login,login,LOGIN_LEN);
+	mystrcpy(slot->req.pass,"bench",PASS_LEN);
+	if(auth_submit(conn,slot)==-1){
+		bailout(EXIT_FAILURE,conn->error);
+	}
+	//keep the reply readable after the slot went back to other clients
+	if(slot != &conn->local){
+		conn->local.resp = slot->resp;
+	}
+	if(auth_release(conn,slot)==-1){
+		bailout(EXIT_FAILURE,conn->error);
+	}
+	return conn->local.resp.state;
+}
+
+static void e2e_sync(AuthConn *conn, const char *name, char *login, int sessId){
+	unsigned int i;
+	long long begin = trace_now();
+	for(i=0;i<requests;i++){
+		if(e2e_request(conn,READ_SECRET,login,sessId)!=STATE_OK){
+			bailout(EXIT_FAILURE,"server refused READ_SECRET");
+		}
+	}
+	report(name,1,(double)(trace_now()-begin)/requests,"ns/op");
+}
+
+static void e2e_pipelined(AuthConn *conn, const char *name, char *login, int sessId, int withFd){
+	MyRequest req;
+	struct pollfd pfd;
+	unsigned int sent = 0;
+	unsigned int received = 0;
+	long long begin;
+	(void)memset(&req, 0, sizeof(req));
+	req.command = READ_SECRET;
+	req.sessId = sessId;
+	mystrcpy(req.login,login,LOGIN_LEN);
+	if(auth_queue_init(&queue,conn)==-1){
+		bailout(EXIT_FAILURE,conn->error);
+	}
+	if(withFd && (pfd.fd = auth_queue_fd(&queue,&pfd.events))==-1){
+		bailout(EXIT_FAILURE,conn->error);
+	}
+	begin = trace_now();
+	while(received < requests){
+		int got;
+		int i;
+		//keep depth requests in flight, a full queue only means collecting first
+		while(sent < requests && sent-received < depth){
+			int result = auth_queue_submit(&queue,&req,(void*)(size_t)sent);
+			if(result == -1){
+				bailout(EXIT_FAILURE,conn->error);
+			}
+			if(result == 1){
+				break;
+			}
+			sent++;
+		}
+		if(withFd){
+			//as a service thread would, with the queue as one fd among others
+			if(poll(&pfd,1,-1)==-1 && errno!=EINTR){
+				bailout(EXIT_FAILURE,"poll failed");
+			}
+			got = auth_queue_poll(&queue,completions,AUTH_QUEUE_DEPTH);
+		}else{
+			got = auth_queue_wait(&queue,completions,AUTH_QUEUE_DEPTH,-1);
+		}
+		if(got == -1){
+			bailout(EXIT_FAILURE,conn->error);
+		}
+		for(i=0;i<got;i++){
+			if(completions[i].resp.state != STATE_OK || (size_t)completions[i].userData >= sent){
+				bailout(EXIT_FAILURE,"bad reply to a pipelined READ_SECRET");
+			}
+		}
+		received += got;
+	}
+	report(name,depth,(double)(trace_now()-begin)/requests,"ns/op");
+	auth_queue_close(&queue);
+}
+
+static void body_search_hit(long ops){
+	char login[LOGIN_LEN];
+	long i;
+	for(i=0;i<ops;i++){
+		bench_name(login,'u',(unsigned int)rand()%size);
+		sink += (long)search_for(&store,login);
+	}
+}
+
+static void body_search_miss(long ops){
+	char login[LOGIN_LEN];
+	long i;
+	for(i=0;i<ops;i++){
+		bench_name(login,'n',(unsigned int)rand()%size);
+		sink += (long)search_for(&store,login);
+	}
+}
+
+static void body_get_session(long ops){
+	long i;
+	for(i=0;i<ops;i++){
+		sink += (long)get_session(&sessions,sessionIds[(unsigned int)rand()%size]);
+	}
+}
+
+static void body_new_session_id(long ops){
+	long i;
+	for(i=0;i<ops;i++){
+		sink += new_session_id(&sessions);
+	}
+}
+
+static double measure(void (*body)(long ops)){
+	long ops = 1;
+	long long elapsed;
+	for(;;){
+		long long begin = trace_now();
+		body(ops);
+		elapsed = trace_now()-begin;
+		if(elapsed >= BENCH_BUDGET_NS){
+			return (double)elapsed/ops;
+		}
+		ops *= 2;
+	}
+}
+
+static void bench_name(char *name, char tag, unsigned int i){
+	static const char digits[] = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+	int len = 1;
+	name[0] = tag;
+	do{
+		name[len++] = digits[i%62];
+		i /= 62;
+	}while(i > 0);
+	name[len] = '\0';
+}
+
+static void build_db(unsigned int n){
+	unsigned int i;
+	long heap = heap_used();
+	long long begin = trace_now();
+	char login[LOGIN_LEN];
+	char pass[PASS_LEN];
+	char secret[SECRET_LEN];
+	for(i=0;i<n;i++){
+		bench_name(login,'u',i);
+		bench_name(pass,'p',i);
+		bench_name(secret,'s',i);
+		if(add_user(&store,login,pass,secret,0)==DB_NO_USER){
+			bailout(EXIT_FAILURE,"malloc failed");
+		}
+	}
+	report("insert_user",n,(double)(trace_now()-begin)/n,"ns/op");
+	if(n*10 > maxUsers){
+		placement_report_region(stdout,"user store",store.login);
+	}
+	if(heap >= 0){
+		report("bytes_per_user",n,(double)(heap_used()-heap)/n,"bytes");
+	}
+	report("store_per_user",n,(double)store_bytes(&store)/n,"bytes");
+}
+
+static void build_sessions(unsigned int n){
+	unsigned int i;
+	long heap;
+	long long begin;
+	sessionIds = (int*) malloc(n*sizeof(int));
+	if(sessionIds == NULL){
+		bailout(EXIT_FAILURE,"malloc failed");
+	}
+	heap = heap_used();
+	begin = trace_now();
+	for(i=0;i<n;i++){
+		session *new = add_session(&sessions,i,0);
+		if(new == NULL){
+			bailout(EXIT_FAILURE,"malloc failed");
+		}
+		sessionIds[i] = new->id;
+	}
+	report("insert_session",n,(double)(trace_now()-begin)/n,"ns/op");
+	if(heap >= 0){
+		report("bytes_per_sess",n,(double)(heap_used()-heap)/n,"bytes");
+	}
+	report("table_per_sess",n,(double)sessions_bytes(&sessions)/n,"bytes");
+}
+
+static void free_db(void){
+	store_free(&store);
+	sessions_free(&sessions);
+	free(sessionIds);
+	sessionIds = NULL;
+}
+
+static long heap_used(void){
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+	struct mallinfo2 info = mallinfo2();
+	return (long)(info.uordblks + info.hblkhd);
+#else
+	return -1;
+#endif
+}
+
+static void report(const char *name, unsigned int n, double value, const char *unit){
+	int i;
+	BenchResult *result;
+	(void)fprintf(stdout,"%-16s %8u %14.1f %-7s",name,n,value,unit);
+	for(i=0;i<baselineCount;i++){
+		if(baseline[i].n == n && strcmp(baseline[i].name,name)==0 && baseline[i].value > 0){
+			(void)fprintf(stdout," %+7.1f%% vs baseline",(value-baseline[i].value)*100.0/baseline[i].value);
+			break;
+		}
+	}
+	(void)fprintf(stdout,"\n");
+	if(resultCount == BENCH_RESULTS){
+		return;
+	}
+	result = &results[resultCount++];
+	mystrcpy(result->name,(char*)name,sizeof(result->name));
+	result->n = n;
+	result->value = value;
+}
+
+static void read_baseline(const char *path){
+	FILE *file;
+	BenchResult *entry;
+	if(!(file = fopen(path,"r"))){
+		(void)fprintf(stderr,"%s couldnt open baseline %s, comparing nothing\n",myname,path);
+		return;
+	}
+	while(baselineCount < BENCH_RESULTS){
+		entry = &baseline[baselineCount];
+		if(fscanf(file,"%31s %u %lf",entry->name,&entry->n,&entry->value)!=3){
+			break;
+		}
+		baselineCount++;
+	}
+	if(fclose(file)==EOF){
+		bailout(EXIT_FAILURE,"error closing baseline file");
+	}
+}
+
+static void write_baseline(const char *path){
+	FILE *file;
+	int i;
+	if(!(file = fopen(path,"w"))){
+		bailout(EXIT_FAILURE,"couldnt create baseline file");
+	}
+	for(i=0;i<resultCount;i++){
+		if(fprintf(file,"%s %u %.1f\n",results[i].name,results[i].n,results[i].value)<0){
+			bailout(EXIT_FAILURE,"failed writing baseline file");
+		}
+	}
+	if(fclose(file)==EOF){
+		bailout(EXIT_FAILURE,"error closing baseline file");
+	}
+	(void)fprintf(stdout,"wrote baseline %s\n",path);
+}
+
+static void parse_args(int argc, char **argv){
+	myname = argv[0];
+	int c;
+	while ((c = getopt(argc, argv, "n:b:w:Hc:N:eU:r:d:")) != -1){
+		switch(c){
+			case 'n':{
+				char *end;
+				long n = strtol(optarg,&end,10);
+				if(*end != '\0' || n < 100 || n > BENCH_MAX_USERS){
+					bailout(EXIT_FAILURE,"usage auth-bench [-n maxusers] [-b baseline] [-w baseline] [-H] [-c cpus] [-N node] | -e [-U socket] [-r requests] [-d depth]");
+				}
+				maxUsers = (unsigned int)n;
+				}
+				break;
+			case 'b':
+				baselinePath = optarg;
+				break;
+			case 'w':
+				writePath = optarg;
+				break;
+			case 'H':
+				placement_huge = 1;
+				break;
+			case 'c':
+				cpuList = optarg;
+				break;
+			case 'N':{
+				char *end;
+				numaNode = (int)strtol(optarg,&end,10);
+				if(*end != '\0' || numaNode < 0){
+					bailout(EXIT_FAILURE,"usage auth-bench [-n maxusers] [-b baseline] [-w baseline] [-H] [-c cpus] [-N node] | -e [-U socket] [-r requests] [-d depth]");
+				}
+				}
+				break;
+			case 'e':
+				e2eMode = 1;
+				break;
+			case 'U':
+				sockPath = optarg;
+				break;
+			case 'r':{
+				char *end;
+				long n = strtol(optarg,&end,10);
+				if(*end != '\0' || n < 1 || n > BENCH_MAX_REQUESTS){
+					bailout(EXIT_FAILURE,"usage auth-bench [-n maxusers] [-b baseline] [-w baseline] [-H] [-c cpus] [-N node] | -e [-U socket] [-r requests] [-d depth]");
+				}
+				requests = (unsigned int)n;
+				}
+				break;
+			case 'd':{
+				char *end;
+				long n = strtol(optarg,&end,10);
+				if(*end != '\0' || n < 1 || n > BENCH_MAX_DEPTH){
+					bailout(EXIT_FAILURE,"usage auth-bench [-n maxusers] [-b baseline] [-w baseline] [-H] [-c cpus] [-N node] | -e [-U socket] [-r requests] [-d depth]");
+				}
+				depth = (unsigned int)n;
+				}
+				break;
+			case '?':
+				bailout(EXIT_FAILURE,"usage auth-bench [-n maxusers] [-b baseline] [-w baseline] [-H] [-c cpus] [-N node] | -e [-U socket] [-r requests] [-d depth]");
+			default:
+				assert(0);
+				break;
+		}
+	}
+	if(optind != argc){
+		bailout(EXIT_FAILURE,"usage auth-bench [-n maxusers] [-b baseline] [-w baseline] [-H] [-c cpus] [-N node] | -e [-U socket] [-r requests] [-d depth]");
+	}
+}
+
+static void bailout(int exitcode, const char *errmsg){
+	(void)fprintf(stderr,"%s %s\n",myname,errmsg);
+	exit(exitcode);
+}
@@ -0,0 +1,37 @@
+#ifndef myauthbench
+#define myauthbench
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <assert.h>
+#include <malloc.h>
+#include "trace.h"
+#include "db.h"
+#include "authclient.h"
+
+//time each measurement runs at least
+#define BENCH_BUDGET_NS (50000000LL)
+#define BENCH_DEFAULT_MAX (100000)
+#define BENCH_MAX_USERS (10000000)
+#define BENCH_RESULTS (256)
+//end to end mode against a running server
+#define BENCH_DEFAULT_REQUESTS (20000)
+#define BENCH_MAX_REQUESTS (10000000)
+#define BENCH_DEFAULT_DEPTH (16)
+//the socket loop reads at most 64 frames per pass, deeper only queues
+#define BENCH_MAX_DEPTH (1024)
+//generated names: a tag, up to 6 base 62 digits of an unsigned int and the terminating 0
+#define BENCH_NAME_LEN (8)
+
+#if LOGIN_LEN < BENCH_NAME_LEN || PASS_LEN < BENCH_NAME_LEN || SECRET_LEN < BENCH_NAME_LEN
+#error "auth-bench needs LOGIN_LEN, PASS_LEN and SECRET_LEN of at least BENCH_NAME_LEN"
+#endif
+
+typedef struct myBenchResultStruct{
+	char name[32];
+	unsigned int n;
+	double value;
+} BenchResult;
+
+#endif
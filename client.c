@@ -39,11 +39,52 @@ static void allocate_ressources(void);
 static void free_ressources(void);
 
  /**
- * @brief waits for semaphore and exits gracefully in case of signal
- * @param sem semaphore to wait on
- * @param description semaphore description that is printed in case of error
+ * @brief called by the transport when a wait was interrupted by a signal
+ * @return never returns nonzero, exits if the client should quit
  */
-static void wait_for_sem(sem_t *sem, char *description);
+static int interrupted(void);
+
+ /**
+ * @brief asks the user for a secret until one with valid length is entered
+ * @param mysecret buffer of SECRET_LEN chars the secret is written to
+ */
+static void prompt_secret(char *mysecret);
+
+ /**
+ * @brief remembers a secret read or written at the given generation
+ * @param secret the secret
+ * @param generation generation of the users slot when the secret was current
+ */
+static void cache_secret(char *secret, unsigned int generation);
+
+ /**
+ * @brief waits for a free slot and claims it
+ * @return the claimed slot, cleared
+ */
+static MyShm *claim_slot(void);
+
+ /**
+ * @brief hands the filled slot to the server and waits for the reply
+ * @param slot the claimed slot holding the request
+ */
+static void submit(MyShm *slot);
+
+ /**
+ * @brief gives the slot back after the reply was read
+ * @param slot the slot to free
+ */
+static void release_slot(MyShm *slot);
+
+ /**
+ * @brief prints the servers request and semaphore counters
+ */
+static void print_stats(void);
+
+ /**
+ * @brief streams all users page by page to stdout
+ * @param command LIST_USERS for logins only or EXPORT_USERS for login;secret lines
+ */
+static void list_users(int command);
 
  /**
  * @brief handles the given signal
@@ -56,24 +97,29 @@ static void handle_signal(int signo);
 static char *myname;
 
  /*
- * shared memory for communication with the server
+ * connection to the server, through shared memory or the socket at sockPath
  */
-static MyShm *shared;
-static int shmfd;
+static AuthConn conn;
+static char *sockPath;
 
 volatile sig_atomic_t quit = 0;
 
- /*
- * semaphore for synchronization
- */
-static sem_t *s_sem;
-static sem_t *c_r_sem;
-static sem_t *c_w_sem;
-
 static int mode;
-static char login[20];
-static char pass[20];
+static char login[LOGIN_LEN];
+static char pass[PASS_LEN];
 static int session;
+static unsigned int version;
+static int has_version;
+
+ /*
+ * last secret seen, valid while the generation of genSlot is unchanged
+ */
+static unsigned int genSlot;
+static char cachedSecret[SECRET_LEN];
+static unsigned int cachedGeneration;
+static int cacheValid;
+static unsigned long cacheHits;
+static unsigned long cacheMisses;
 
 /**
  * @brief Program entry point
@@ -98,85 +144,81 @@ int main(int argc, char **argv){
 	if(sigaction (SIGTERM , &s, NULL )==-1){
 		bailout(EXIT_FAILURE,"error on sigaction initialization");
 	}
+	if(sigaction (SIGUSR1 , &s, NULL )==-1){
+		bailout(EXIT_FAILURE,"error on sigaction initialization");
+	}
+	trace_init("auth-client");
+	auth_init(&conn,interrupted);
 	
 	if(atexit(free_ressources)!=0){
 		bailout(EXIT_FAILURE,"couldnt set atexit");
 	}
 	parse_args(argc,argv);
-	if(strlen(argv[optind])>19||strlen(argv[optind+1])>19){
-		bailout(EXIT_FAILURE,"Username and password must be max 19 characters!");
+	if(mode == STATS_MODE){
+		allocate_ressources();
+		print_stats();
+		bailout(EXIT_SUCCESS,"success");
+	}
+	if(mode == LIST_USERS || mode == EXPORT_USERS){
+		allocate_ressources();
+		list_users(mode);
+		bailout(EXIT_SUCCESS,"success");
+	}
+	if(strlen(argv[optind])>LOGIN_LEN-1||strlen(argv[optind+1])>PASS_LEN-1){
+		char msg[80];
+		(void)snprintf(msg,sizeof(msg),"Username must be max %d and password max %d characters!",LOGIN_LEN-1,PASS_LEN-1);
+		bailout(EXIT_FAILURE,msg);
 	}
 	
-	mystrcpy(login,argv[optind],20);
-	mystrcpy(pass,argv[optind+1],20);
+	mystrcpy(login,argv[optind],LOGIN_LEN);
+	mystrcpy(pass,argv[optind+1],PASS_LEN);
 
 	allocate_ressources();
 	
 	
 	switch(mode){
 		case REGISTER:{
-			wait_for_sem(c_w_sem,"client write sem");
-			(void)memset(shared, 0, sizeof(MyShm));
-			shared->state = 0;
-			mystrcpy(shared->login,login,20);
-			mystrcpy(shared->pass,pass,20);
-			shared->command=REGISTER;
-			int c = sem_post(s_sem);
-			if(c!= 0){
-				bailout(EXIT_FAILURE,"server semaphore error");
-			}
-			wait_for_sem(c_r_sem,"client read sem");
-			if(shared->state==0){
-				c = sem_post(c_w_sem);
-				if(c!= 0){
-					bailout(EXIT_FAILURE,"client write semaphore error");
-				}
+			MyShm *slot = claim_slot();
+			mystrcpy(slot->req.login,login,LOGIN_LEN);
+			mystrcpy(slot->req.pass,pass,PASS_LEN);
+			slot->req.command=REGISTER;
+			submit(slot);
+			if(slot->resp.state==0){
+				release_slot(slot);
 				bailout(EXIT_SUCCESS,"success");
 			}else{
-				c = sem_post(c_w_sem);
-				if(c!= 0){
-					bailout(EXIT_FAILURE,"client write semaphore error");
-				}
+				release_slot(slot);
 				bailout(EXIT_FAILURE,"registration failed");
 			}
 		}
 		break;
 		case LOGIN:{
-			wait_for_sem(c_w_sem,"client write sem");
-			(void)memset(shared, 0, sizeof(MyShm));
-			shared->state = 0;
-			mystrcpy(shared->login,login,20);
-			mystrcpy(shared->pass,pass,20);
-			shared->command=LOGIN;
-			int c = sem_post(s_sem);
-			if(c!= 0){
-				bailout(EXIT_FAILURE,"server semaphore error");
-			}
-			wait_for_sem(c_r_sem,"client read sem");
-			if(shared->state==0){
-				session = shared->sessId;
+			MyShm *slot = claim_slot();
+			mystrcpy(slot->req.login,login,LOGIN_LEN);
+			mystrcpy(slot->req.pass,pass,PASS_LEN);
+			slot->req.command=LOGIN;
+			submit(slot);
+			if(slot->resp.state==0){
+				session = slot->resp.sessId;
+				genSlot = slot->resp.genSlot;
 				(void)fprintf(stdout,"logged in with id %d\n",session);
-				(void)memset(shared, 0, sizeof(MyShm));
-				shared->state = 0;
-				
-				c = sem_post(c_w_sem);
-				if(c!= 0){
-					bailout(EXIT_FAILURE,"client write semaphore error");
-				}
+				release_slot(slot);
+			}else if(slot->resp.state==STATE_THROTTLED){
+				release_slot(slot);
+				bailout(EXIT_FAILURE,"too many failed logins, try again later");
 			}else{
-				c = sem_post(c_w_sem);
-				if(c!= 0){
-					bailout(EXIT_FAILURE,"client write semaphore error");
-				}
+				release_slot(slot);
 				bailout(EXIT_FAILURE,"login failed");
 			}
 		while(!quit){
-			(void)fprintf(stdout,"%s\n%s\n%s\n%s\n%s"
+			trace_poll();
+			(void)fprintf(stdout,"%s\n%s\n%s\n%s\n%s\n%s"
 			,"Commands:"
 			,"  1) write secret"
 			,"  2) read secret"
 			,"  3) logout"
-			,"Please select a command (1-3):");
+			,"  4) write secret if unchanged since last read"
+			,"Please select a command (1-4):");
 			int myInt;
 			int result = scanf("%d", &myInt);
 
@@ -196,106 +238,108 @@ int main(int argc, char **argv){
 				}else{
 					switch(myInt){
 						case 1:{
-						//TODO enter secret
-						int accepted = 0;
-						char mysecret[50];
-						while(!accepted){
-							(void)memset(&mysecret[0], 0, sizeof(mysecret));
-							(void)fprintf(stdout,"%s","Please enter your new secret:");
-							char ch;
-							int count = 0;
-							while ((ch = fgetc(stdin)) != '\n'){
-								if(count <49){
-									mysecret[count] = ch;
-								}
-								count++;
-							}
-							if(count > 49){
-								(void)fprintf(stdout,"%s","Your secret must be maximum 49 characters long!\n");
-							}else{
-								accepted = 1;
-								mysecret[count] = '\0';
-							}
-						}
-						
-						wait_for_sem(c_w_sem,"client write sem");
-						mystrcpy(shared->login,login,20);
-						mystrcpy(shared->secret,mysecret,50);
-						shared->command=WRITE_SECRET;
-						shared->sessId = session;
+						char mysecret[SECRET_LEN];
+						prompt_secret(mysecret);
 						
-						c = sem_post(s_sem);
-						if(c!= 0){
-							bailout(EXIT_FAILURE,"server semaphore error");
-						}
-						wait_for_sem(c_r_sem,"client read sem");
-						if(shared->state==0){
+						MyShm *slot = claim_slot();
+						mystrcpy(slot->req.login,login,LOGIN_LEN);
+						mystrcpy(slot->req.secret,mysecret,SECRET_LEN);
+						slot->req.command=WRITE_SECRET;
+						slot->req.sessId = session;
+						submit(slot);
+						if(slot->resp.state==0){
 							(void)fprintf(stdout,"successfully wrote secret\n");
-							c = sem_post(c_w_sem);
-							if(c!= 0){
-								bailout(EXIT_FAILURE,"client write semaphore error");
-							}
+							version = slot->resp.version;
+							has_version = 1;
+							cache_secret(mysecret,slot->resp.generation);
+							release_slot(slot);
 						}else{
-							c = sem_post(c_w_sem);
-							if(c!= 0){
-								bailout(EXIT_FAILURE,"client write semaphore error");
-							}
+							release_slot(slot);
 							bailout(EXIT_FAILURE,"");
 						}
 						}
 						break;
-						case 2:
-						wait_for_sem(c_w_sem,"client write sem");
-						mystrcpy(shared->login,login,20);
-						shared->command=READ_SECRET;
-						shared->sessId = session;
-						c = sem_post(s_sem);
-						if(c!= 0){
-							bailout(EXIT_FAILURE,"server semaphore error");
-						}
-						wait_for_sem(c_r_sem,"client read sem");
-						if(shared->state==0){
-							char secret[50];
-							mystrcpy(secret,shared->secret,50);
-							(void)fprintf(stdout,"Your secret is: %s\n",secret);
-							c = sem_post(c_w_sem);
-							if(c!= 0){
-								bailout(EXIT_FAILURE,"client write semaphore error");
+						case 2:{
+						//the generation table is only visible through shared memory
+						if(conn.shared != NULL){
+							if(cacheValid && conn.shared->generation[genSlot]==cachedGeneration){
+								cacheHits++;
+								(void)__sync_fetch_and_add(&conn.shared->clientStats.client_cache_hits,1);
+								(void)fprintf(stdout,"Your secret is: %s (version %u)\n",cachedSecret,version);
+								break;
 							}
+							cacheMisses++;
+							(void)__sync_fetch_and_add(&conn.shared->clientStats.client_cache_misses,1);
+						}
+						MyShm *slot = claim_slot();
+						mystrcpy(slot->req.login,login,LOGIN_LEN);
+						slot->req.command=READ_SECRET;
+						slot->req.sessId = session;
+						submit(slot);
+						if(slot->resp.state==0){
+							char secret[SECRET_LEN];
+							mystrcpy(secret,slot->resp.secret,SECRET_LEN);
+							version = slot->resp.version;
+							has_version = 1;
+							cache_secret(secret,slot->resp.generation);
+							(void)fprintf(stdout,"Your secret is: %s (version %u)\n",secret,version);
+							release_slot(slot);
 						}else{
-							c = sem_post(c_w_sem);
-							if(c!= 0){
-								bailout(EXIT_FAILURE,"client write semaphore error");
-							}
+							release_slot(slot);
 							bailout(EXIT_FAILURE,"Server returned an error");
 						}
-						break;
-						case 3:
-						wait_for_sem(c_w_sem,"client write sem");
-						mystrcpy(shared->login,login,19);
-						shared->command=LOGOUT;
-						shared->sessId = session;
-						c = sem_post(s_sem);
-						if(c!= 0){
-							bailout(EXIT_FAILURE,"server semaphore error");
 						}
-						wait_for_sem(c_r_sem,"client read sem");
-						if(shared->state==0){
-							c = sem_post(c_w_sem);
-							if(c!= 0){
-								bailout(EXIT_FAILURE,"client write semaphore error");
-							}
+						break;
+						case 3:{
+						MyShm *slot = claim_slot();
+						mystrcpy(slot->req.login,login,LOGIN_LEN);
+						slot->req.command=LOGOUT;
+						slot->req.sessId = session;
+						submit(slot);
+						if(slot->resp.state==0){
+							release_slot(slot);
 							bailout(EXIT_SUCCESS,"logged out");
 						}else{
-							c = sem_post(c_w_sem);
-							if(c!= 0){
-								bailout(EXIT_FAILURE,"client write semaphore error");
-							}
+							release_slot(slot);
 							bailout(EXIT_FAILURE,"logout failed");
 						}
+						}
+						break;
+						case 4:{
+						if(!has_version){
+							(void)fprintf(stdout,"%s\n","please read your secret first");
+							break;
+						}
+						char mysecret[SECRET_LEN];
+						prompt_secret(mysecret);
+						
+						MyShm *slot = claim_slot();
+						mystrcpy(slot->req.login,login,LOGIN_LEN);
+						mystrcpy(slot->req.secret,mysecret,SECRET_LEN);
+						slot->req.command=CAS_SECRET;
+						slot->req.sessId = session;
+						slot->req.version = version;
+						submit(slot);
+						if(slot->resp.state==0){
+							version = slot->resp.version;
+							cache_secret(mysecret,slot->resp.generation);
+							(void)fprintf(stdout,"successfully wrote secret (version %u)\n",version);
+							release_slot(slot);
+						}else if(slot->resp.state==STATE_CONFLICT){
+							char secret[SECRET_LEN];
+							mystrcpy(secret,slot->resp.secret,SECRET_LEN);
+							version = slot->resp.version;
+							cache_secret(secret,slot->resp.generation);
+							(void)fprintf(stdout,"secret was changed meanwhile, not written. Current secret is: %s (version %u)\n",secret,version);
+							release_slot(slot);
+						}else{
+							release_slot(slot);
+							bailout(EXIT_FAILURE,"Server returned an error");
+						}
+						}
 						break;
 						default:
-						(void)fprintf(stdout,"%s\n","please enter a number from 1-3");
+						(void)fprintf(stdout,"%s\n","please enter a number from 1-4");
 						break;
 					}
 				}
@@ -324,12 +368,123 @@ static void handle_signal(int signo){
   if (signo == SIGTERM){
 	  quit = 1;
   }
+  
+  if (signo == SIGUSR1){
+	  trace_request_dump();
+  }
    
 }
 
 static void mystrcpy(char *dest,char *source,int size){
 	(void)strncpy(dest,source,size-1);
-	dest[size]='\0';
+	dest[size-1]='\0';
+}
+
+static void prompt_secret(char *mysecret){
+	int accepted = 0;
+	while(!accepted){
+		(void)memset(mysecret, 0, SECRET_LEN);
+		(void)fprintf(stdout,"%s","Please enter your new secret:");
+		char ch;
+		int count = 0;
+		while ((ch = fgetc(stdin)) != '\n'){
+			if(count <SECRET_LEN-1){
+				mysecret[count] = ch;
+			}
+			count++;
+		}
+		if(count > SECRET_LEN-1){
+			(void)fprintf(stdout,"Your secret must be maximum %d characters long!\n",SECRET_LEN-1);
+		}else if(strchr(mysecret,';') != NULL){
+			//the server stores users as csv lines
+			(void)fprintf(stdout,"%s","Your secret must not contain a ;\n");
+		}else{
+			accepted = 1;
+			mysecret[count] = '\0';
+		}
+	}
+}
+
+static void cache_secret(char *secret, unsigned int generation){
+	mystrcpy(cachedSecret,secret,SECRET_LEN);
+	cachedGeneration = generation;
+	cacheValid = 1;
+}
+
+static MyShm *claim_slot(void){
+	MyShm *slot = auth_claim(&conn);
+	if(slot == NULL){
+		bailout(conn.shutdown ? EXIT_SUCCESS : EXIT_FAILURE,conn.error);
+	}
+	return slot;
+}
+
+static void submit(MyShm *slot){
+	if(auth_submit(&conn,slot) == -1){
+		bailout(conn.shutdown ? EXIT_SUCCESS : EXIT_FAILURE,conn.error);
+	}
+}
+
+static void release_slot(MyShm *slot){
+	if(auth_release(&conn,slot) == -1){
+		bailout(EXIT_FAILURE,conn.error);
+	}
+}
+
+static void list_users(int command){
+	unsigned int cursor = 0;
+	do{
+		MyShm *slot = claim_slot();
+		slot->req.command = command;
+		slot->req.cursor = cursor;
+		submit(slot);
+		if(slot->resp.state!=0){
+			release_slot(slot);
+			bailout(EXIT_FAILURE,"listing refused by server");
+		}
+		if(slot->resp.count > 0 && fputs(slot->resp.page,stdout)==EOF){
+			release_slot(slot);
+			bailout(EXIT_FAILURE,"couldnt write listing");
+		}
+		cursor = slot->resp.cursor;
+		release_slot(slot);
+	}while(cursor != 0);
+}
+
+static void print_stats(void){
+	MyStats st = conn.shared->stats;
+	MyClientStats cst = conn.shared->clientStats;
+	unsigned long sems = st.server_wakeups+st.server_reply_posts+cst.client_wakeup_posts;
+	(void)fprintf(stdout,"requests: %lu\n",st.requests);
+	(void)fprintf(stdout,"server wakeups: %lu\n",st.server_wakeups);
+	(void)fprintf(stdout,"server passes: %lu\n",st.server_passes);
+	(void)fprintf(stdout,"server reply posts: %lu\n",st.server_reply_posts);
+	(void)fprintf(stdout,"client wakeup posts: %lu\n",cst.client_wakeup_posts);
+	(void)fprintf(stdout,"client wakeup posts skipped: %lu\n",cst.client_wakeup_skips);
+	(void)fprintf(stdout,"client secret cache hits: %lu\n",cst.client_cache_hits);
+	(void)fprintf(stdout,"client secret cache misses: %lu\n",cst.client_cache_misses);
+	(void)fprintf(stdout,"failed logins: %lu\n",st.login_failures);
+	(void)fprintf(stdout,"logins throttled per login: %lu\n",st.login_throttled_login);
+	(void)fprintf(stdout,"logins throttled globally: %lu\n",st.login_throttled_global);
+	(void)fprintf(stdout,"slots recovered from dead clients: %lu\n",st.recovered_slots);
+	(void)fprintf(stdout,"sessions recovered from dead clients: %lu\n",st.recovered_sessions);
+	(void)fprintf(stdout,"wakeups recovered from dead clients: %lu\n",st.recovered_wakeups);
+	if(st.recovered_slots>0){
+		(void)fprintf(stdout,"dead client slot held on average: %.2f ms, at most: %.2f ms\n"
+			,st.recovery_ns_total/1e6/st.recovered_slots,st.recovery_ns_max/1e6);
+	}
+	(void)fprintf(stdout,"users: %lu\n",st.db_users);
+	(void)fprintf(stdout,"sessions: %lu\n",st.db_sessions);
+	if(st.db_users>0){
+		(void)fprintf(stdout,"bytes per user: %.1f\n",(double)st.db_user_bytes/st.db_users);
+	}
+	if(st.db_sessions>0){
+		(void)fprintf(stdout,"bytes per session: %.1f\n",(double)st.db_session_bytes/st.db_sessions);
+	}
+	if(st.requests>0){
+		(void)fprintf(stdout,"requests per wakeup: %.2f\n",st.server_wakeups>0?(double)st.requests/st.server_wakeups:(double)st.requests);
+		(void)fprintf(stdout,"semaphore ops per request: %.2f\n",(double)sems/st.requests);
+	}
 }
 
 
@@ -337,14 +492,14 @@ static void parse_args(int argc, char **argv){
 	myname = argv[0];
 	int c;
 	int i = 0;
-	while ((c = getopt(argc, argv, "lr")) != -1){
+	while ((c = getopt(argc, argv, "lrsueU:")) != -1){
 		switch(c){
 			case 'l':
 				if(i == 0){
 					i++;
 					mode = LOGIN;
 				}else{
-					bailout(EXIT_FAILURE,"usage auth-client { -r | -l } username password");
+					bailout(EXIT_FAILURE,"usage auth-client [-U socket] { -r | -l } username password | -s | -u | -e");
 				}
 				break;
 			case 'r':
@@ -352,70 +507,69 @@ static void parse_args(int argc, char **argv){
 					i++;
 					mode = REGISTER;
 				}else{
-					bailout(EXIT_FAILURE,"usage auth-client { -r | -l } username password");
+					bailout(EXIT_FAILURE,"usage auth-client [-U socket] { -r | -l } username password | -s | -u | -e");
 				}
 				break;
+			case 's':
+				if(i == 0){
+					i++;
+					mode = STATS_MODE;
+				}else{
+					bailout(EXIT_FAILURE,"usage auth-client [-U socket] { -r | -l } username password | -s | -u | -e");
+				}
+				break;
+			case 'u':
+				if(i == 0){
+					i++;
+					mode = LIST_USERS;
+				}else{
+					bailout(EXIT_FAILURE,"usage auth-client [-U socket] { -r | -l } username password | -s | -u | -e");
+				}
+				break;
+			case 'e':
+				if(i == 0){
+					i++;
+					mode = EXPORT_USERS;
+				}else{
+					bailout(EXIT_FAILURE,"usage auth-client [-U socket] { -r | -l } username password | -s | -u | -e");
+				}
+				break;
+			case 'U':
+				sockPath = optarg;
+				break;
 			case '?':
-				bailout(EXIT_FAILURE,"usage auth-client { -r | -l } username password");
+				bailout(EXIT_FAILURE,"usage auth-client [-U socket] { -r | -l } username password | -s | -u | -e");
 			default:
 				assert(0);
 				break;
 		}
 	}
+	if(mode == STATS_MODE || mode == LIST_USERS || mode == EXPORT_USERS){
+		return;
+	}
 	if((optind+1>=argc)||i==0){
-		bailout(EXIT_FAILURE,"usage auth-client { -r | -l } username password");
+		bailout(EXIT_FAILURE,"usage auth-client [-U socket] { -r | -l } username password | -s | -u | -e");
 	}
 	
 }
 
 static void allocate_ressources(void){
-	//initialize shared memory
-	shmfd =shm_open(SHM_NAME, O_RDWR, PERMISSION);
-	if(shmfd==-1){
-		bailout(EXIT_FAILURE,"couldnt open shared memory");
-	}
-	if(ftruncate(shmfd, sizeof *shared) == -1){
-		bailout(EXIT_FAILURE,"couldnt set the size of shared memory");
-	}
-	shared = mmap(NULL, sizeof *shared, PROT_READ | PROT_WRITE, MAP_SHARED, shmfd, 0);
-	if(shared == MAP_FAILED){
-		bailout(EXIT_FAILURE,"couldnt map shared memory");
-	}
-	if(shared == NULL){
-		bailout(EXIT_FAILURE,"couldnt malloc shm");
-	}
-	
-	//initialize semaphors
-	s_sem = sem_open(SERVER_SEM, 0);
-	if(s_sem == SEM_FAILED){
-		bailout(EXIT_FAILURE,"creating sem1 failed!");
-	}
-	c_r_sem = sem_open(CLIENT_READ_SEM, 0);
-	if(c_r_sem == SEM_FAILED){
-		bailout(EXIT_FAILURE,"creating sem2 failed!");
-	}
-	c_w_sem = sem_open(CLIENT_WRITE_SEM, 0);
-	if(c_w_sem == SEM_FAILED){
-		bailout(EXIT_FAILURE,"creating sem3 failed!");
+	//stats live in shared memory only, so they ignore the socket
+	if(sockPath != NULL && mode != STATS_MODE){
+		if(auth_open_socket(&conn,sockPath) == -1){
+			bailout(EXIT_FAILURE,conn.error);
+		}
+	}else if(auth_open_shm(&conn) == -1){
+		bailout(EXIT_FAILURE,conn.error);
 	}
-	
-	
 }
 
-static void wait_for_sem(sem_t *sem, char *description){
-	while((sem_wait(sem))==-1){
-			if(errno == EINTR){
-				if(quit){
-					bailout(EXIT_SUCCESS,"terminated due to signal");
-				}
-			}else{
-				bailout(EXIT_FAILURE,description);
-			}
-	}
-	if(shared->state==-1){
-		(void)sem_post(c_w_sem);
-		bailout(EXIT_SUCCESS,"server has shut down, closing");
+static int interrupted(void){
+	if(quit){
+		bailout(EXIT_SUCCESS,"terminated due to signal");
 	}
+	trace_poll();
+	return 0;
 }
 
 static void bailout(int exitcode, const char *errmsg){
@@ -424,10 +578,10 @@ static void bailout(int exitcode, const char *errmsg){
 }
 
 static void free_ressources(void){
-	(void)close(shmfd);
-	(void)munmap(shared, sizeof *shared);
-	(void)sem_close(s_sem);
-	(void)sem_close(c_r_sem);
-	(void)sem_close(c_w_sem);
-	
+	if(cacheHits+cacheMisses > 0){
+		(void)fprintf(stdout,"secret cache: %lu hits, %lu misses\n",cacheHits,cacheMisses);
+	}
+	(void)trace_dump();
+	auth_close(&conn);
+
 }
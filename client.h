@@ -10,4 +10,9 @@
 #include<signal.h>
 #include <assert.h>
 #include <string.h>
+#include "trace.h"
+#include "authclient.h"
+
+//client only mode that prints the server counters
+#define STATS_MODE (0x100)
 #endif
\ No newline at end of file
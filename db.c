@@ -0,0 +1,683 @@
+/**
+ * @file db.c
+ * @author David Schrder 1226747
+ * @brief User and session storage of the auth server
+ * @details Kept apart from server.c so auth-bench can measure it directly.
+ *          Users are columns of string pool offsets, found through an open
+ *          addressing table, sessions only keep the index of their user.
+ * @date 08.01.2017
+ */
+#include "db.h"
+
+ /**
+ * @brief splits off the next ; separated field, unlike strtok empty fields count
+ * @param pos position in the line, moved behind the field, NULL after the last
+ * @return the field or NULL if there is none left
+ */
+static char *next_field(char **pos);
+
+ /*
+ * the change log read so far while replaying it, a record stays until its newline was read
+ */
+static char logChunk[DB_LOG_CHUNK];
+
+ /**
+ * @brief fnv-1a hash of a string
+ * @param str the string
+ */
+static unsigned int hash_string(const char *str);
+
+ /**
+ * @brief spreads a session id over the table
+ * @param id the session id
+ */
+static unsigned int hash_id(int id);
+
+ /**
+ * @brief allocates a zeroed hash table
+ * @param cap number of slots, a power of two
+ * @return the table or NULL if malloc failed
+ */
+static unsigned int *new_table(unsigned int cap);
+
+ /**
+ * @brief grows a column of the store
+ * @param column the column
+ * @param oldCap entries it holds now
+ * @param cap entries it has to hold
+ * @return 0 on success, -1 if malloc failed
+ */
+static int grow_column(unsigned int **column, unsigned int oldCap, unsigned int cap);
+
+ /**
+ * @brief allocates an empty pool holding only the empty string
+ * @param pool the pool
+ * @param bytes bytes to reserve
+ * @param strings strings to reserve table slots for
+ * @return 0 on success, -1 if malloc failed
+ */
+static int pool_init(StringPool *pool, size_t bytes, unsigned int strings);
+
+ /**
+ * @brief frees the memory of a pool
+ * @param pool the pool
+ */
+static void pool_free(StringPool *pool);
+
+ /**
+ * @brief finds a string in the pool or appends it
+ * @param pool the pool
+ * @param str the string, must not point into the pool
+ * @param offset set to the offset of the string
+ * @return 0 on success, -1 if malloc failed
+ */
+static int pool_intern(StringPool *pool, const char *str, unsigned int *offset);
+
+ /**
+ * @brief moves the pool table into one with cap slots
+ * @param pool the pool
+ * @param cap number of slots, a power of two
+ * @return 0 on success, -1 if malloc failed
+ */
+static int pool_rehash(StringPool *pool, unsigned int cap);
+
+ /**
+ * @brief rebuilds the pool from the strings still referenced
+ * @details replaced secrets stay in the pool until this runs
+ * @param store the store
+ * @return 0 on success, -1 if malloc failed, the old pool is kept then
+ */
+static int compact(UserStore *store);
+
+ /**
+ * @brief moves the login table into one with cap slots
+ * @param store the store
+ * @param cap number of slots, a power of two
+ * @return 0 on success, -1 if malloc failed
+ */
+static int login_rehash(UserStore *store, unsigned int cap);
+
+ /**
+ * @brief moves the session table into one with cap slots
+ * @param table the sessions
+ * @param cap number of slots, a power of two
+ * @return 0 on success, -1 if malloc failed
+ */
+static int session_rehash(SessionTable *table, unsigned int cap);
+
+ /**
+ * @brief finds the table slot of a session
+ * @param table the sessions
+ * @param sessionid the session id
+ * @return the slot or byIdCap if the id is not in use
+ */
+static unsigned int session_slot(SessionTable *table, int sessionid);
+
+void store_init(UserStore *store){
+	(void)memset(store, 0, sizeof(UserStore));
+}
+
+void store_free(UserStore *store){
+	pool_free(&store->pool);
+	placement_free(store->login, store->cap*sizeof(unsigned int));
+	placement_free(store->pass, store->cap*sizeof(unsigned int));
+	placement_free(store->secret, store->cap*sizeof(unsigned int));
+	placement_free(store->version, store->cap*sizeof(unsigned int));
+	placement_free(store->byLogin, store->byLoginCap*sizeof(unsigned int));
+	store_init(store);
+}
+
+unsigned int search_for(UserStore *store, const char *login){
+	unsigned int mask = store->byLoginCap-1;
+	unsigned int i;
+	TRACE_BEGIN(begin);
+	if(store->byLogin == NULL){
+		TRACE_END("search_for",begin,-1);
+		return DB_NO_USER;
+	}
+	for(i=hash_string(login)&mask;store->byLogin[i]!=0;i=(i+1)&mask){
+		unsigned int user = store->byLogin[i]-1;
+		if(strcmp(store->pool.bytes+store->login[user],login)==0){
+			TRACE_END("search_for",begin,-1);
+			return user;
+		}
+	}
+	TRACE_END("search_for",begin,-1);
+	return DB_NO_USER;
+}
+
+unsigned int add_user(UserStore *store, const char *login, const char *pass, const char *secret, unsigned int version){
+	unsigned int offsets[3];
+	unsigned int user = store->count;
+	unsigned int mask;
+	unsigned int i;
+	if(store->pool.bytes == NULL && pool_init(&store->pool, DB_MIN_POOL, DB_MIN_TABLE/2)==-1){
+		return DB_NO_USER;
+	}
+	if(store->count == store->cap){
+		unsigned int cap = store->cap == 0 ? DB_MIN_TABLE : store->cap*2;
+		if(grow_column(&store->login,store->cap,cap)==-1 || grow_column(&store->pass,store->cap,cap)==-1
+			|| grow_column(&store->secret,store->cap,cap)==-1 || grow_column(&store->version,store->cap,cap)==-1){
+			return DB_NO_USER;
+		}
+		store->cap = cap;
+	}
+	if(2*(store->count+1) > store->byLoginCap
+		&& login_rehash(store, store->byLoginCap == 0 ? DB_MIN_TABLE : store->byLoginCap*2)==-1){
+		return DB_NO_USER;
+	}
+	if(pool_intern(&store->pool,login,&offsets[0])==-1 || pool_intern(&store->pool,pass,&offsets[1])==-1
+		|| pool_intern(&store->pool,secret,&offsets[2])==-1){
+		return DB_NO_USER;
+	}
+	store->login[user] = offsets[0];
+	store->pass[user] = offsets[1];
+	store->secret[user] = offsets[2];
+	store->version[user] = version;
+	mask = store->byLoginCap-1;
+	for(i=hash_string(login)&mask;store->byLogin[i]!=0;i=(i+1)&mask){
+	}
+	store->byLogin[i] = user+1;
+	store->count++;
+	return user;
+}
+
+int set_pass(UserStore *store, unsigned int user, const char *pass){
+	return pool_intern(&store->pool,pass,&store->pass[user]);
+}
+
+int set_secret(UserStore *store, unsigned int user, const char *secret){
+	if(pool_intern(&store->pool,secret,&store->secret[user])==-1){
+		return -1;
+	}
+	if(store->pool.used > DB_MIN_COMPACT && store->pool.used > 2*store->pool.compacted){
+		//only garbage is lost if it fails, so the old pool just stays
+		(void)compact(store);
+	}
+	return 0;
+}
+
+const char *user_login(UserStore *store, unsigned int user){
+	return store->pool.bytes+store->login[user];
+}
+
+const char *user_pass(UserStore *store, unsigned int user){
+	return store->pool.bytes+store->pass[user];
+}
+
+const char *user_secret(UserStore *store, unsigned int user){
+	return store->pool.bytes+store->secret[user];
+}
+
+size_t store_bytes(UserStore *store){
+	return 4*store->cap*sizeof(unsigned int) + store->byLoginCap*sizeof(unsigned int)
+		+ store->pool.cap + store->pool.slotCap*sizeof(unsigned int);
+}
+
+void sessions_init(SessionTable *table){
+	(void)memset(table, 0, sizeof(SessionTable));
+}
+
+void sessions_free(SessionTable *table){
+	placement_free(table->sessions, table->cap*sizeof(session));
+	placement_free(table->byId, table->byIdCap*sizeof(unsigned int));
+	sessions_init(table);
+}
+
+session *get_session(SessionTable *table, int sessionid){
+	unsigned int slot;
+	TRACE_BEGIN(begin);
+	slot = session_slot(table,sessionid);
+	TRACE_END("get_session",begin,-1);
+	return slot == table->byIdCap ? NULL : &table->sessions[table->byId[slot]-1];
+}
+
+session *add_session(SessionTable *table, unsigned int user, pid_t owner){
+	unsigned int mask;
+	unsigned int i;
+	session *new;
+	if(table->count == table->cap){
+		unsigned int cap = table->cap == 0 ? DB_MIN_TABLE : table->cap*2;
+		session *grown = (session*) placement_grow(table->sessions, table->cap*sizeof(session), cap*sizeof(session));
+		if(grown == NULL){
+			return NULL;
+		}
+		table->sessions = grown;
+		table->cap = cap;
+	}
+	if(2*(table->count+1) > table->byIdCap
+		&& session_rehash(table, table->byIdCap == 0 ? DB_MIN_TABLE : table->byIdCap*2)==-1){
+		return NULL;
+	}
+	new = &table->sessions[table->count];
+	new->id = new_session_id(table);
+	new->user = user;
+	new->owner = owner;
+	mask = table->byIdCap-1;
+	for(i=hash_id(new->id)&mask;table->byId[i]!=0;i=(i+1)&mask){
+	}
+	table->byId[i] = ++table->count;
+	return new;
+}
+
+void drop_session(SessionTable *table, int sessionid){
+	unsigned int mask = table->byIdCap-1;
+	unsigned int hole = session_slot(table,sessionid);
+	unsigned int pos;
+	unsigned int i;
+	if(hole == table->byIdCap){
+		return;
+	}
+	pos = table->byId[hole]-1;
+	//backward shift, moves later entries of the probe run into the hole
+	for(i=(hole+1)&mask;table->byId[i]!=0;i=(i+1)&mask){
+		unsigned int home = hash_id(table->sessions[table->byId[i]-1].id)&mask;
+		if(hole <= i ? (hole < home && home <= i) : (hole < home || home <= i)){
+			continue;
+		}
+		table->byId[hole] = table->byId[i];
+		hole = i;
+	}
+	table->byId[hole] = 0;
+	//the last session moves into the freed position
+	table->count--;
+	if(pos != table->count){
+		table->sessions[pos] = table->sessions[table->count];
+		table->byId[session_slot(table,table->sessions[pos].id)] = pos+1;
+	}
+}
+
+int new_session_id(SessionTable *table){
+	int id = rand();
+	while(session_slot(table,id) != table->byIdCap){
+		id = rand();
+	}
+	return id;
+}
+
+size_t sessions_bytes(SessionTable *table){
+	return table->cap*sizeof(session) + table->byIdCap*sizeof(unsigned int);
+}
+
+static unsigned int session_slot(SessionTable *table, int sessionid){
+	unsigned int mask = table->byIdCap-1;
+	unsigned int i;
+	if(table->byId == NULL){
+		return table->byIdCap;
+	}
+	for(i=hash_id(sessionid)&mask;table->byId[i]!=0;i=(i+1)&mask){
+		if(table->sessions[table->byId[i]-1].id == sessionid){
+			return i;
+		}
+	}
+	return table->byIdCap;
+}
+
+static unsigned int hash_string(const char *str){
+	unsigned int hash = 2166136261u;
+	while(*str != '\0'){
+		hash = (hash ^ (unsigned char)*str++) * 16777619u;
+	}
+	return hash;
+}
+
+static unsigned int hash_id(int id){
+	//rand() ids are uniform already, the multiply only spreads sequential ones
+	return (unsigned int)id * 2654435761u;
+}
+
+static unsigned int *new_table(unsigned int cap){
+	unsigned int *table = (unsigned int*) placement_grow(NULL, 0, cap*sizeof(unsigned int));
+	if(table != NULL){
+		(void)memset(table, 0, cap*sizeof(unsigned int));
+	}
+	return table;
+}
+
+static int grow_column(unsigned int **column, unsigned int oldCap, unsigned int cap){
+	unsigned int *grown = (unsigned int*) placement_grow(*column, oldCap*sizeof(unsigned int), cap*sizeof(unsigned int));
+	if(grown == NULL){
+		return -1;
+	}
+	*column = grown;
+	return 0;
+}
+
+static int pool_init(StringPool *pool, size_t bytes, unsigned int strings){
+	unsigned int slots = DB_MIN_TABLE;
+	(void)memset(pool, 0, sizeof(StringPool));
+	while(slots < 2*strings){
+		slots *= 2;
+	}
+	pool->bytes = (char*) placement_grow(NULL, 0, bytes);
+	pool->slots = new_table(slots);
+	if(pool->bytes == NULL || pool->slots == NULL){
+		placement_free(pool->bytes, bytes);
+		placement_free(pool->slots, slots*sizeof(unsigned int));
+		return -1;
+	}
+	pool->cap = bytes;
+	pool->slotCap = slots;
+	pool->bytes[0] = '\0';
+	pool->used = 1;
+	pool->compacted = 1;
+	return 0;
+}
+
+static void pool_free(StringPool *pool){
+	placement_free(pool->bytes, pool->cap);
+	placement_free(pool->slots, pool->slotCap*sizeof(unsigned int));
+	(void)memset(pool, 0, sizeof(StringPool));
+}
+
+static int pool_intern(StringPool *pool, const char *str, unsigned int *offset){
+	size_t len = strlen(str);
+	unsigned int mask;
+	unsigned int i;
+	if(len == 0){
+		*offset = 0;
+		return 0;
+	}
+	if(2*(pool->strings+1) > pool->slotCap && pool_rehash(pool, pool->slotCap*2)==-1){
+		return -1;
+	}
+	mask = pool->slotCap-1;
+	for(i=hash_string(str)&mask;pool->slots[i]!=0;i=(i+1)&mask){
+		if(strcmp(pool->bytes+pool->slots[i],str)==0){
+			*offset = pool->slots[i];
+			return 0;
+		}
+	}
+	if(pool->used+len+1 > pool->cap){
+		size_t cap = pool->cap*2;
+		char *grown;
+		while(pool->used+len+1 > cap){
+			cap *= 2;
+		}
+		grown = (char*) placement_grow(pool->bytes, pool->cap, cap);
+		if(grown == NULL){
+			return -1;
+		}
+		pool->bytes = grown;
+		pool->cap = cap;
+	}
+	(void)memcpy(pool->bytes+pool->used, str, len+1);
+	pool->slots[i] = (unsigned int)pool->used;
+	*offset = (unsigned int)pool->used;
+	pool->used += len+1;
+	pool->strings++;
+	return 0;
+}
+
+static int pool_rehash(StringPool *pool, unsigned int cap){
+	unsigned int *slots = new_table(cap);
+	unsigned int i;
+	if(slots == NULL){
+		return -1;
+	}
+	for(i=0;i<pool->slotCap;i++){
+		if(pool->slots[i] != 0){
+			unsigned int j = hash_string(pool->bytes+pool->slots[i])&(cap-1);
+			while(slots[j] != 0){
+				j = (j+1)&(cap-1);
+			}
+			slots[j] = pool->slots[i];
+		}
+	}
+	placement_free(pool->slots, pool->slotCap*sizeof(unsigned int));
+	pool->slots = slots;
+	pool->slotCap = cap;
+	return 0;
+}
+
+static int compact(UserStore *store){
+	StringPool fresh;
+	unsigned int user;
+	size_t bytes = 1;
+	unsigned int strings = 3*store->count;
+	for(user=0;user<store->count;user++){
+		bytes += strlen(user_login(store,user))+strlen(user_pass(store,user))+strlen(user_secret(store,user))+3;
+	}
+	if(bytes > store->pool.used){
+		bytes = store->pool.used;
+	}
+	if(strings > store->pool.strings){
+		strings = store->pool.strings;
+	}
+	//both are upper bounds of the live strings, so interning below cannot fail
+	if(pool_init(&fresh, bytes < DB_MIN_POOL ? DB_MIN_POOL : bytes, strings)==-1){
+		return -1;
+	}
+	for(user=0;user<store->count;user++){
+		(void)pool_intern(&fresh, store->pool.bytes+store->login[user], &store->login[user]);
+		(void)pool_intern(&fresh, store->pool.bytes+store->pass[user], &store->pass[user]);
+		(void)pool_intern(&fresh, store->pool.bytes+store->secret[user], &store->secret[user]);
+	}
+	fresh.compacted = fresh.used;
+	pool_free(&store->pool);
+	store->pool = fresh;
+	return 0;
+}
+
+static int login_rehash(UserStore *store, unsigned int cap){
+	unsigned int *table = new_table(cap);
+	unsigned int user;
+	if(table == NULL){
+		return -1;
+	}
+	for(user=0;user<store->count;user++){
+		unsigned int i = hash_string(store->pool.bytes+store->login[user])&(cap-1);
+		while(table[i] != 0){
+			i = (i+1)&(cap-1);
+		}
+		table[i] = user+1;
+	}
+	placement_free(store->byLogin, store->byLoginCap*sizeof(unsigned int));
+	store->byLogin = table;
+	store->byLoginCap = cap;
+	return 0;
+}
+
+static int session_rehash(SessionTable *table, unsigned int cap){
+	unsigned int *byId = new_table(cap);
+	unsigned int pos;
+	if(byId == NULL){
+		return -1;
+	}
+	for(pos=0;pos<table->count;pos++){
+		unsigned int i = hash_id(table->sessions[pos].id)&(cap-1);
+		while(byId[i] != 0){
+			i = (i+1)&(cap-1);
+		}
+		byId[i] = pos+1;
+	}
+	placement_free(table->byId, table->byIdCap*sizeof(unsigned int));
+	table->byId = byId;
+	table->byIdCap = cap;
+	return 0;
+}
+
+int load_db(UserStore *store, const char *path, const char **errmsg){
+	FILE *dbfile;
+	char buff[DB_LINE];
+	if(!(dbfile = fopen(path,"r"))){
+		*errmsg = "couldnt open database file";
+		return -1;
+	}
+	while (fgets(buff,DB_LINE,dbfile)!=NULL){
+		if(apply_record(store,buff,errmsg)==-1){
+			(void)fclose(dbfile);
+			return -1;
+		}
+	}
+	if(fclose(dbfile)==EOF){
+		*errmsg = "error closing db file";
+		return -1;
+	}
+	*errmsg = NULL;
+	return 0;
+}
+
+int replay_log(UserStore *store, const char *path, const char **errmsg){
+	FILE *logfile;
+	size_t buffered = 0;
+	size_t got;
+	unsigned long records = 0;
+	if(access(path,F_OK)==-1 && errno == ENOENT){
+		//nothing logged yet
+		*errmsg = NULL;
+		return 0;
+	}
+	if(!(logfile = fopen(path,"r"))){
+		*errmsg = "couldnt open database file";
+		return -1;
+	}
+	while((got = fread(logChunk+buffered,1,sizeof(logChunk)-buffered,logfile)) > 0){
+		ssize_t used;
+		buffered += got;
+		used = apply_records(store,logChunk,buffered,&records,errmsg);
+		if(used == -1){
+			(void)fclose(logfile);
+			return -1;
+		}
+		buffered -= used;
+		(void)memmove(logChunk, logChunk+used, buffered);
+		if(buffered == sizeof(logChunk)){
+			*errmsg = "change log holds a record longer than a chunk";
+			(void)fclose(logfile);
+			return -1;
+		}
+	}
+	if(ferror(logfile)){
+		*errmsg = "couldnt read change log";
+		(void)fclose(logfile);
+		return -1;
+	}
+	//what is left is the torn last record or zeros of a crash
+	if(fclose(logfile)==EOF){
+		*errmsg = "error closing db file";
+		return -1;
+	}
+	*errmsg = NULL;
+	return 0;
+}
+
+ssize_t apply_records(UserStore *store, char *buffer, size_t len, unsigned long *records, const char **errmsg){
+	char *line = buffer;
+	char *end;
+	while((end = memchr(line, '\n', len-(line-buffer))) != NULL){
+		*end = '\0';
+		//zeros of a write that is still in flight or was lost in a crash
+		while(*line == '\0' && line < end){
+			line++;
+		}
+		if(line < end){
+			if(apply_record(store,line,errmsg)==-1){
+				return -1;
+			}
+			(*records)++;
+		}
+		line = end+1;
+	}
+	*errmsg = NULL;
+	return line-buffer;
+}
+
+int apply_record(UserStore *store, char *line, const char **errmsg){
+	char *pos = line;
+	char *login;
+	char *pass;
+	char *secret;
+	char *token;
+	unsigned int version = 0;
+	unsigned int user;
+	*errmsg = "database file corrupted";
+	login = next_field(&pos);
+	if(login == NULL || strlen(login)==0 || strlen(login)>LOGIN_LEN-1){
+		return -1;
+	}
+	pass = next_field(&pos);
+	if(pass == NULL || strlen(pass)>PASS_LEN-1){
+		return -1;
+	}
+	secret = next_field(&pos);
+	if(secret == NULL || strlen(secret)>SECRET_LEN-1){
+		return -1;
+	}
+	//the version column is optional, files of older servers only have three
+	token = next_field(&pos);
+	if(token != NULL){
+		char *end;
+		version = (unsigned int)strtoul(token,&end,10);
+		if(end == token || *end != '\0' || next_field(&pos) != NULL){
+			return -1;
+		}
+	}
+	user = search_for(store,login);
+	if(user == DB_NO_USER){
+		if(add_user(store,login,pass,secret,version) == DB_NO_USER){
+			*errmsg = "malloc failed";
+			return -1;
+		}
+	}else{
+		if(set_pass(store,user,pass)==-1 || set_secret(store,user,secret)==-1){
+			*errmsg = "malloc failed";
+			return -1;
+		}
+		store->version[user] = version;
+	}
+	*errmsg = NULL;
+	return 0;
+}
+
+static char *next_field(char **pos){
+	char *field = *pos;
+	char *end;
+	if(field == NULL){
+		return NULL;
+	}
+	end = field + strcspn(field, DB_SEPARATORS);
+	if(*end == ';'){
+		*pos = end+1;
+	}else{
+		*pos = NULL;
+	}
+	*end = '\0';
+	return field;
+}
+
+int storable_field(const char *field){
+	return field[strcspn(field, DB_SEPARATORS)] == '\0';
+}
+
+int format_user(char *buf, size_t size, UserStore *store, unsigned int user){
+	return snprintf(buf,size,"%s;%s;%s;%u\n",user_login(store,user),user_pass(store,user),user_secret(store,user),store->version[user]);
+}
+
+int dumpdb(UserStore *store, const char *path){
+	FILE *dbfile;
+	char line[DB_LINE];
+	unsigned int user;
+	if(!(dbfile = fopen(path,"w"))){
+		(void)fprintf(stderr,"Couldnt create file %s\n",path);
+		return -1;
+	}
+	for(user=0;user<store->count;user++){
+		(void)format_user(line,sizeof(line),store,user);
+		if(fputs(line,dbfile)==EOF){
+			(void)fprintf(stderr,"failed writing line into db file with errno %d",errno);
+			(void)fclose(dbfile);
+			return -1;
+		}
+	}
+	if(fclose(dbfile)==EOF){
+		(void)fprintf(stderr,"failed to close db file with errno %d",errno);
+		return -1;
+	}
+	return 0;
+}
+
+void mystrcpy(char *dest,const char *source,int size){
+	(void)strncpy(dest,source,size-1);
+	dest[size-1]='\0';
+}
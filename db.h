@@ -0,0 +1,279 @@
+#ifndef myauthdb
+#define myauthdb
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include "myshared.h"
+#include "trace.h"
+#include "placement.h"
+
+//characters that end a csv field, stored strings must not contain them
+#define DB_SEPARATORS ";\n"
+//longest csv line is login;pass;secret;version plus newline, with room to spare
+#define DB_LINE (LOGIN_LEN+PASS_LEN+SECRET_LEN+16)
+
+//hash tables are grown at half load
+#define DB_MIN_TABLE (64)
+//first allocation of the string pool
+#define DB_MIN_POOL (4096)
+//the string pool is compacted once it is twice its last compacted size and at least this big
+#define DB_MIN_COMPACT (64*1024)
+#define DB_NO_USER (0xffffffffu)
+//replay reads the change log in chunks, one holds a lost log buffer of zeros and the record behind it
+#define DB_LOG_CHUNK (128*1024)
+
+ /*
+ * every distinct string once, NUL terminated and referenced by its offset.
+ * offset 0 is the empty string, slots is a hash table of offsets with 0 as empty.
+ * bytes moves when it grows, so pointers into it are only valid until the next intern
+ */
+typedef struct myStringPoolStruct{
+	char *bytes;
+	size_t used;
+	size_t cap;
+	size_t compacted;
+	unsigned int *slots;
+	unsigned int slotCap;
+	unsigned int strings;
+} StringPool;
+
+ /*
+ * users in registration order as columns, a user is its index.
+ * cursors of LIST_USERS and EXPORT_USERS and the generation slots index into it.
+ * the columns grow with placement_grow so -H puts them on huge pages
+ */
+typedef struct myUserStoreStruct{
+	StringPool pool;
+	unsigned int *login;
+	unsigned int *pass;
+	unsigned int *secret;
+	unsigned int *version;
+	unsigned int count;
+	unsigned int cap;
+	unsigned int *byLogin;
+	unsigned int byLoginCap;
+} UserStore;
+
+//owner is the pid of the client that logged in, 0 if unknown
+typedef struct mySessionStruct{
+	int id;
+	unsigned int user;
+	pid_t owner;
+} session;
+
+ /*
+ * logged in sessions, dense so dropping one moves the last into its place.
+ * byId is a hash table of positions plus one with 0 as empty
+ */
+typedef struct mySessionTableStruct{
+	session *sessions;
+	unsigned int count;
+	unsigned int cap;
+	unsigned int *byId;
+	unsigned int byIdCap;
+} SessionTable;
+
+ /**
+ * @brief empties a store, it allocates on the first add
+ * @param store the store
+ */
+void store_init(UserStore *store);
+
+ /**
+ * @brief frees all memory of a store
+ * @param store the store
+ */
+void store_free(UserStore *store);
+
+ /**
+ * @brief looks up a user by login
+ * @param store the store
+ * @param login login to search for
+ * @return the user or DB_NO_USER
+ */
+unsigned int search_for(UserStore *store, const char *login);
+
+ /**
+ * @brief appends a user, the login must not exist yet
+ * @param store the store
+ * @param login the login
+ * @param pass the password
+ * @param secret the secret
+ * @param version version of the secret
+ * @return the new user or DB_NO_USER if malloc failed
+ */
+unsigned int add_user(UserStore *store, const char *login, const char *pass, const char *secret, unsigned int version);
+
+ /**
+ * @brief replaces the password of a user
+ * @param store the store
+ * @param user the user
+ * @param pass the new password
+ * @return 0 on success, -1 if malloc failed
+ */
+int set_pass(UserStore *store, unsigned int user, const char *pass);
+
+ /**
+ * @brief replaces the secret of a user, leaving its version alone
+ * @param store the store
+ * @param user the user
+ * @param secret the new secret
+ * @return 0 on success, -1 if malloc failed
+ */
+int set_secret(UserStore *store, unsigned int user, const char *secret);
+
+ /**
+ * @brief login of a user, valid until the next change of the store
+ * @param store the store
+ * @param user the user
+ */
+const char *user_login(UserStore *store, unsigned int user);
+
+ /**
+ * @brief password of a user, valid until the next change of the store
+ * @param store the store
+ * @param user the user
+ */
+const char *user_pass(UserStore *store, unsigned int user);
+
+ /**
+ * @brief secret of a user, valid until the next change of the store
+ * @param store the store
+ * @param user the user
+ */
+const char *user_secret(UserStore *store, unsigned int user);
+
+ /**
+ * @brief bytes the store holds, columns, tables and pool
+ * @param store the store
+ */
+size_t store_bytes(UserStore *store);
+
+ /**
+ * @brief empties a session table, it allocates on the first add
+ * @param table the table
+ */
+void sessions_init(SessionTable *table);
+
+ /**
+ * @brief frees all memory of a session table
+ * @param table the table
+ */
+void sessions_free(SessionTable *table);
+
+ /**
+ * @brief searches the session with the given id
+ * @param table the table
+ * @param sessionid sessionid to look for
+ * @return the session, valid until the next add or drop, or NULL
+ */
+session *get_session(SessionTable *table, int sessionid);
+
+ /**
+ * @brief adds a session with an id that is not in use yet
+ * @param table the table
+ * @param user the user the session belongs to
+ * @param owner pid of the client that logged in, 0 if unknown
+ * @return the session, valid until the next add or drop, or NULL if malloc failed
+ */
+session *add_session(SessionTable *table, unsigned int user, pid_t owner);
+
+ /**
+ * @brief drops a session from the table
+ * @param table the table
+ * @param sessionid sessionid to look for
+ */
+void drop_session(SessionTable *table, int sessionid);
+
+ /**
+ * @brief picks a random session id that is not in use yet
+ * @param table the table
+ */
+int new_session_id(SessionTable *table);
+
+ /**
+ * @brief bytes the session table holds
+ * @param table the table
+ */
+size_t sessions_bytes(SessionTable *table);
+
+ /**
+ * @brief loads users from a login;pass;secret[;version] csv file
+ * @param store the store to append to
+ * @param path the file to read
+ * @param errmsg set to a description of the failure
+ * @return 0 on success, -1 on error
+ */
+int load_db(UserStore *store, const char *path, const char **errmsg);
+
+ /**
+ * @brief replays a change log of login;pass;secret;version lines
+ * @details later lines of a user overwrite earlier ones and users loaded
+ *          before, a missing file is an empty log
+ * @param store the store to apply it to
+ * @param path the log to read
+ * @param errmsg set to a description of the failure
+ * @return 0 on success, -1 on error
+ */
+int replay_log(UserStore *store, const char *path, const char **errmsg);
+
+ /**
+ * @brief applies one login;pass;secret[;version] line, overwriting an existing user
+ * @param store the store
+ * @param line the line, with or without newline, it is modified
+ * @param errmsg set to a description of the failure
+ * @return 0 on success, -1 on error
+ */
+int apply_record(UserStore *store, char *line, const char **errmsg);
+
+ /**
+ * @brief applies all complete lines of a piece of the change log
+ * @details zeros in front of a line are a write that is still in flight or
+ *          was lost in a crash and are skipped, the standby and the replay
+ *          on start read the log through this alike
+ * @param store the store
+ * @param buffer the piece, its lines are modified
+ * @param len bytes in buffer
+ * @param records incremented for every applied line
+ * @param errmsg set to a description of the failure
+ * @return bytes up to and including the last newline, -1 on error
+ */
+ssize_t apply_records(UserStore *store, char *buffer, size_t len, unsigned long *records, const char **errmsg);
+
+ /**
+ * @brief checks whether a string survives a round trip through a csv line
+ * @param field the string to store
+ * @return 1 if it holds none of DB_SEPARATORS, 0 otherwise
+ */
+int storable_field(const char *field);
+
+ /**
+ * @brief writes the csv line of a user, as read by load_db and replay_log
+ * @param buf buffer to write to, DB_LINE bytes always suffice
+ * @param size size of buf
+ * @param store the store
+ * @param user the user
+ * @return length of the line as snprintf returns it
+ */
+int format_user(char *buf, size_t size, UserStore *store, unsigned int user);
+
+ /**
+ * @brief dumps the db into csv
+ * @param store the store
+ * @param path the file to write
+ * @return 0 on success, -1 on error
+ */
+int dumpdb(UserStore *store, const char *path);
+
+ /**
+ * @brief same as strcpy but adds tailing null byte after size-1 chars
+ * @param dest string to copy to
+ * @param source string to copy from
+ * @param size maximum size including null byte
+ */
+void mystrcpy(char *dest, const char *source, int size);
+
+#endif
@@ -8,8 +8,10 @@
 #include <sys/stat.h> 
 #include <semaphore.h>
 #include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 //semaphore def
-#define CLIENT_READ_SEM "/1226747clrsem"
 #define CLIENT_WRITE_SEM "/1226747clwsem"
 #define SERVER_SEM "/1226747srwsem"
 
@@ -19,18 +21,197 @@
 #define WRITE_SECRET (3)
 #define READ_SECRET (4)
 #define LOGOUT (5)
+#define CAS_SECRET (6)
+#define LIST_USERS (7)
+#define EXPORT_USERS (8)
 
+//reply states
+#define STATE_OK (0)
+#define STATE_ERROR (1)
+#define STATE_CONFLICT (2)
+#define STATE_THROTTLED (3)
+
+
+//record widths including the terminating 0, set by the makefile, clients and server have to agree on them
+#ifndef LOGIN_LEN
+#define LOGIN_LEN (20)
+#endif
+#ifndef PASS_LEN
+#define PASS_LEN (20)
+#endif
+#ifndef SECRET_LEN
+#define SECRET_LEN (50)
+#endif
 
 //shared mem def
 #define SHM_NAME "/1226747myshared"
 #define PERMISSION (0600)
-typedef struct myshmstruct {
-	unsigned int state;
+#define SHM_SLOTS (8)
+#define SHM_PAGE (1024)
+#define SHM_MAGIC (0x41555448)
+#define SHM_LAYOUT_VERSION (10)
+#define SHM_GENERATIONS (1024)
+#define CACHE_LINE (64)
+#define CACHE_ALIGNED __attribute__((aligned(CACHE_LINE)))
+
+#if LOGIN_LEN < 2 || PASS_LEN < 1 || SECRET_LEN < 1
+#error "LOGIN_LEN has to leave room for one character, PASS_LEN and SECRET_LEN for the terminating 0"
+#endif
+//a listing page has to hold at least one login;secret line
+#if LOGIN_LEN + SECRET_LEN + 1 > SHM_PAGE
+#error "LOGIN_LEN and SECRET_LEN do not fit into one SHM_PAGE"
+#endif
+
+//slot phases, a slot cycles FREE -> CLAIMED -> READY -> DONE -> FREE
+#define SLOT_FREE (0)
+#define SLOT_CLAIMED (1)
+#define SLOT_READY (2)
+#define SLOT_DONE (3)
+//owner of a slot the server is taking back from a dead client, no client can claim it meanwhile
+#define SLOT_RECLAIMING ((pid_t)-1)
+
+/*
+ * written by the client only, read by the server while the slot is READY
+ */
+typedef struct myrequeststruct {
+	unsigned int seq;
 	int command;
 	int sessId;
-	char login[20];
-	char pass[20];
-	char secret[50];
+	unsigned int version;
+	unsigned int cursor;
+	char login[LOGIN_LEN];
+	char pass[PASS_LEN];
+	char secret[SECRET_LEN];
+} MyRequest;
+
+/*
+ * written by the server only, read by the client once the slot is DONE.
+ * page holds count entries and starts with 0 if count is 0, the bytes after
+ * the last entry may be left over from an earlier reply, so a client never
+ * reads the page without checking count
+ */
+typedef struct myresponsestruct {
+	unsigned int seq;
+	unsigned int state;
+	int sessId;
+	unsigned int version;
+	unsigned int cursor;
+	int count;
+	unsigned int genSlot;
+	unsigned int generation;
+	char secret[SECRET_LEN];
+	char page[SHM_PAGE];
+} MyResponse;
+
+/*
+ * one request slot, the client owns it from CLAIMED until it frees it again,
+ * the server only touches it while it is READY and posts done afterwards.
+ * owner is the pid of the client holding the slot and 0 while it is free,
+ * claiming is the swap of owner so the server can take back the slot of a
+ * client that died at any point while holding it.
+ * the control words, request and response live on separate cache lines so
+ * each line is only written by one side per exchange
+ */
+typedef struct myshmstruct {
+	volatile int phase;
+	volatile pid_t owner;
+	long long claimed;
+	sem_t done;
+	MyRequest req CACHE_ALIGNED;
+	MyResponse resp CACHE_ALIGNED;
 } MyShm;
 
+/*
+ * written once by the server before the magic, clients refuse to attach
+ * to a segment whose layout does not match their own
+ */
+typedef struct myshmheaderstruct {
+	volatile unsigned int magic;
+	unsigned int layout;
+	unsigned int size;
+	unsigned int slots;
+	unsigned int slotSize;
+	unsigned int page;
+	unsigned int loginLen;
+	unsigned int passLen;
+	unsigned int secretLen;
+	//a standby takes over once this process is gone
+	pid_t pid;
+} MyShmHeader;
+
+/*
+ * counters to check how many semaphore operations a request costs,
+ * only written by the server
+ */
+typedef struct mystatsstruct {
+	unsigned long requests;
+	unsigned long server_wakeups;
+	unsigned long server_passes;
+	unsigned long server_reply_posts;
+	//footprint of the user store and session table, updated after every batch
+	unsigned long db_users;
+	unsigned long db_sessions;
+	unsigned long db_user_bytes;
+	unsigned long db_session_bytes;
+	//failed logins and logins refused before the lookup by the login or the global bucket
+	unsigned long login_failures;
+	unsigned long login_throttled_login;
+	unsigned long login_throttled_global;
+	//slots and sessions taken back from dead clients, and how long the slots were held
+	unsigned long recovered_slots;
+	unsigned long recovered_sessions;
+	unsigned long long recovery_ns_total;
+	unsigned long long recovery_ns_max;
+	//wakeups the server posted for waiting clients next to a free slot
+	unsigned long recovered_wakeups;
+} MyStats;
+
+/*
+ * counters of the socket transport, only written by its thread
+ */
+typedef struct mysockstatsstruct {
+	unsigned long sock_connections;
+	unsigned long sock_requests;
+	unsigned long sock_wakeups;
+	unsigned long sock_reads;
+	unsigned long sock_writes;
+} MySockStats;
+
+/*
+ * counters atomically updated by the clients
+ */
+typedef struct myclientstatsstruct {
+	unsigned long client_wakeup_posts;
+	unsigned long client_wakeup_skips;
+	unsigned long client_cache_hits;
+	unsigned long client_cache_misses;
+} MyClientStats;
+
+/*
+ * the whole shared segment, clients post SERVER_SEM only if sleeping is set.
+ * a client only waits on CLIENT_WRITE_SEM while no slot is free, slotWaiters
+ * counts them and a freed slot only posts it while someone may wait. the
+ * semaphore is only a wakeup, a slot belongs to whoever swaps its owner.
+ * generation[id % SHM_GENERATIONS] is bumped by the server on every secret
+ * write of user id, so a client may keep serving a secret it read while the
+ * generation of its user is unchanged
+ */
+typedef struct mysegmentstruct {
+	MyShmHeader header;
+	volatile unsigned int state CACHE_ALIGNED;
+	volatile int sleeping;
+	volatile int slotWaiters;
+	MyStats stats CACHE_ALIGNED;
+	MySockStats sockStats CACHE_ALIGNED;
+	MyClientStats clientStats CACHE_ALIGNED;
+	MyShm slot[SHM_SLOTS] CACHE_ALIGNED;
+	volatile unsigned int generation[SHM_GENERATIONS] CACHE_ALIGNED;
+} MySegment;
+
+//socket transport def, every frame is a 4 byte length in host order followed by the payload
+#define FRAME_HEADER (sizeof(uint32_t))
+//requests are sent whole, responses only up to the end of the used page
+#define REQUEST_FRAME_SIZE (sizeof(MyRequest))
+#define RESPONSE_FRAME_SIZE(resp) (offsetof(MyResponse,page)+strlen((resp)->page)+1)
+
 #endif
\ No newline at end of file
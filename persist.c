@@ -0,0 +1,591 @@
+/**
+ * @file persist.c
+ * @author David Schrder 1226747
+ * @brief Change log and snapshot writer of the auth server
+ * @details Records are collected in memory and written with one write and
+ *          one fdatasync per buffer. Through io_uring the write and sync are
+ *          submitted as a linked pair that drains the ring, so log buffers
+ *          still land in order, and are reaped on later calls. Without it a
+ *          few threads do the same with pwrite, one log buffer at a time.
+ * @date 08.01.2017
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "persist.h"
+
+#define BACKEND_NONE (0)
+#define BACKEND_URING (1)
+#define BACKEND_THREADS (2)
+
+ /**
+ * @brief allocates an empty job
+ * @param kind PERSIST_LOG or PERSIST_SNAPSHOT
+ * @param cap bytes to reserve for its data
+ * @return the job or NULL if malloc failed
+ */
+static PersistJob *new_job(int kind, size_t cap);
+
+ /**
+ * @brief moves the buffer being filled to the jobs waiting for the log
+ */
+static void close_current(void);
+
+ /**
+ * @brief hands waiting log jobs to the writer, the threads get one at a time
+ */
+static void start_next(void);
+
+ /**
+ * @brief hands a job to the writer in use
+ * @param job the job
+ */
+static void dispatch(PersistJob *job);
+
+ /**
+ * @brief accounts a finished job, renames finished snapshots and frees it
+ * @param job the job
+ */
+static void finish_job(PersistJob *job);
+
+ /**
+ * @brief frees a job and its data
+ * @param job the job
+ */
+static void free_job(PersistJob *job);
+
+ /**
+ * @brief sets up a ring with raw syscalls, liburing is not needed
+ * @return 0 on success, -1 if the kernel refuses io_uring
+ */
+static int uring_setup(void);
+
+ /**
+ * @brief unmaps and closes whatever uring_setup got to
+ */
+static void uring_teardown(void);
+
+ /**
+ * @brief submits the write and fdatasync of a job as linked entries
+ * @param job the job
+ */
+static void uring_submit(PersistJob *job);
+
+ /**
+ * @brief collects finished entries
+ * @param wait 1 to wait for at least one completion, 0 to only look
+ */
+static void uring_reap(int wait);
+
+ /**
+ * @brief writes and syncs jobs of the fallback queue until persist_stop
+ * @param arg unused
+ * @return NULL
+ */
+static void *writer_loop(void *arg);
+
+static int backend = BACKEND_NONE;
+static PersistStats stats;
+
+ /*
+ * the log, the offset the next buffer goes to and the buffer being filled
+ */
+static int logFd = -1;
+static char logPath[PERSIST_PATH];
+static off_t logOffset;
+static PersistJob *current;
+
+ /*
+ * log buffers waiting for the one in flight, in log order
+ */
+static PersistJob *waiting;
+static PersistJob *waitingTail;
+static int logBusy;
+static unsigned long inflight;
+
+ /*
+ * guards everything above against the fallback writers
+ */
+static pthread_mutex_t persistLock = PTHREAD_MUTEX_INITIALIZER;
+
+ /*
+ * the ring, mapped as the kernel describes it in io_uring_params
+ */
+static int ringFd = -1;
+static void *sqRing = MAP_FAILED;
+static void *cqRing = MAP_FAILED;
+static size_t sqRingSize;
+static size_t cqRingSize;
+static struct io_uring_sqe *sqes = MAP_FAILED;
+static size_t sqesSize;
+static unsigned int *sqTail;
+static unsigned int *sqMask;
+static unsigned int *sqArray;
+static unsigned int *cqHead;
+static unsigned int *cqTail;
+static unsigned int *cqMask;
+static struct io_uring_cqe *cqes;
+static unsigned int cqEntries;
+
+ /*
+ * fallback queue and its writers
+ */
+static PersistJob *queue;
+static PersistJob *queueTail;
+static pthread_cond_t queueCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t drainedCond = PTHREAD_COND_INITIALIZER;
+static pthread_t writers[PERSIST_THREADS];
+static int writerCount;
+static int stopping;
+
+int persist_start(const char *path){
+	struct stat st;
+	if(path != NULL){
+		if(strlen(path) >= PERSIST_PATH){
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		(void)strcpy(logPath, path);
+		//explicit offsets instead of O_APPEND, writes may be in flight while the next is queued
+		logFd = open(path, O_WRONLY | O_CREAT, 0666);
+		if(logFd == -1 || fstat(logFd, &st) == -1){
+			return -1;
+		}
+		logOffset = st.st_size;
+	}
+	if(uring_setup() == 0){
+		backend = BACKEND_URING;
+		return 0;
+	}
+	sigset_t blocked;
+	sigset_t old;
+	(void)sigfillset(&blocked);
+	(void)pthread_sigmask(SIG_BLOCK, &blocked, &old);
+	for(writerCount=0;writerCount<PERSIST_THREADS;writerCount++){
+		int err = pthread_create(&writers[writerCount], NULL, writer_loop, NULL);
+		if(err != 0){
+			(void)pthread_sigmask(SIG_SETMASK, &old, NULL);
+			errno = err;
+			return -1;
+		}
+	}
+	(void)pthread_sigmask(SIG_SETMASK, &old, NULL);
+	backend = BACKEND_THREADS;
+	return 0;
+}
+
+int persist_user(UserStore *store, unsigned int user){
+	if(logFd == -1){
+		return 0;
+	}
+	(void)pthread_mutex_lock(&persistLock);
+	if(current != NULL && current->cap - current->used < DB_LINE){
+		close_current();
+	}
+	if(current == NULL && (current = new_job(PERSIST_LOG, PERSIST_BUFFER)) == NULL){
+		(void)pthread_mutex_unlock(&persistLock);
+		return -1;
+	}
+	current->used += format_user(current->data + current->used, DB_LINE, store, user);
+	stats.records++;
+	(void)pthread_mutex_unlock(&persistLock);
+	return 0;
+}
+
+void persist_flush(void){
+	TRACE_BEGIN(begin);
+	(void)pthread_mutex_lock(&persistLock);
+	if(current != NULL){
+		close_current();
+	}
+	if(backend == BACKEND_URING && inflight > 0){
+		uring_reap(0);
+	}
+	start_next();
+	(void)pthread_mutex_unlock(&persistLock);
+	TRACE_END("persist_flush",begin,-1);
+}
+
+int persist_snapshot(UserStore *store, const char *path){
+	PersistJob *job;
+	unsigned int user;
+	char tmp[PERSIST_PATH+sizeof(".tmp")];
+	if(backend == BACKEND_NONE){
+		return dumpdb(store, path);
+	}
+	if(strlen(path) >= PERSIST_PATH){
+		return -1;
+	}
+	if((job = new_job(PERSIST_SNAPSHOT, PERSIST_BUFFER)) == NULL){
+		return -1;
+	}
+	(void)strcpy(job->path, path);
+	for(user=0;user<store->count;user++){
+		if(job->cap - job->used < DB_LINE){
+			char *grown = (char*) realloc(job->data, job->cap*2);
+			if(grown == NULL){
+				free_job(job);
+				return -1;
+			}
+			job->data = grown;
+			job->cap *= 2;
+		}
+		job->used += format_user(job->data + job->used, DB_LINE, store, user);
+	}
+	//written next to the old snapshot and renamed over it once durable
+	(void)snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	job->fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if(job->fd == -1){
+		free_job(job);
+		return -1;
+	}
+	(void)pthread_mutex_lock(&persistLock);
+	dispatch(job);
+	(void)pthread_mutex_unlock(&persistLock);
+	return 0;
+}
+
+void persist_stop(void){
+	int i;
+	if(backend == BACKEND_NONE){
+		return;
+	}
+	(void)pthread_mutex_lock(&persistLock);
+	if(current != NULL){
+		close_current();
+	}
+	start_next();
+	while(inflight > 0 || waiting != NULL){
+		if(backend == BACKEND_URING){
+			uring_reap(1);
+		}else{
+			(void)pthread_cond_wait(&drainedCond, &persistLock);
+		}
+		start_next();
+	}
+	stopping = 1;
+	(void)pthread_cond_broadcast(&queueCond);
+	(void)pthread_mutex_unlock(&persistLock);
+	for(i=0;i<writerCount;i++){
+		(void)pthread_join(writers[i], NULL);
+	}
+	uring_teardown();
+	if(logFd != -1){
+		(void)close(logFd);
+		logFd = -1;
+	}
+	backend = BACKEND_NONE;
+}
+
+const char *persist_backend(void){
+	switch(backend){
+		case BACKEND_URING:
+			return "io_uring";
+		case BACKEND_THREADS:
+			return "threads";
+		default:
+			return "none";
+	}
+}
+
+PersistStats *persist_stats(void){
+	return &stats;
+}
+
+static PersistJob *new_job(int kind, size_t cap){
+	PersistJob *job = (PersistJob*) malloc(sizeof(PersistJob));
+	if(job == NULL){
+		return NULL;
+	}
+	(void)memset(job, 0, sizeof(PersistJob));
+	job->data = (char*) malloc(cap);
+	if(job->data == NULL){
+		free(job);
+		return NULL;
+	}
+	job->kind = kind;
+	job->fd = -1;
+	job->cap = cap;
+	return job;
+}
+
+static void close_current(void){
+	PersistJob *job = current;
+	current = NULL;
+	if(job->used == 0){
+		free_job(job);
+		return;
+	}
+	job->fd = logFd;
+	job->offset = logOffset;
+	logOffset += job->used;
+	(void)strcpy(job->path, logPath);
+	if(waitingTail == NULL){
+		waiting = job;
+	}else{
+		waitingTail->next = job;
+	}
+	waitingTail = job;
+}
+
+static void start_next(void){
+	//the ring orders log writes itself and must not wait for a later call to move on
+	while(waiting != NULL && (backend == BACKEND_URING || !logBusy)){
+		PersistJob *job = waiting;
+		waiting = job->next;
+		if(waiting == NULL){
+			waitingTail = NULL;
+		}
+		job->next = NULL;
+		logBusy = 1;
+		dispatch(job);
+	}
+}
+
+static void dispatch(PersistJob *job){
+	inflight++;
+	if(inflight > stats.max_inflight){
+		stats.max_inflight = inflight;
+	}
+	if(backend == BACKEND_URING){
+		uring_submit(job);
+		return;
+	}
+	if(queueTail == NULL){
+		queue = job;
+	}else{
+		queueTail->next = job;
+	}
+	queueTail = job;
+	(void)pthread_cond_signal(&queueCond);
+}
+
+static void finish_job(PersistJob *job){
+	if(job->failed){
+		stats.errors++;
+		(void)fprintf(stderr,"persist: writing %s failed\n",job->path);
+	}else{
+		stats.writes++;
+		stats.syncs++;
+		stats.bytes += job->used;
+	}
+	if(job->kind == PERSIST_SNAPSHOT){
+		char tmp[PERSIST_PATH+sizeof(".tmp")];
+		(void)close(job->fd);
+		(void)snprintf(tmp, sizeof(tmp), "%s.tmp", job->path);
+		if(job->failed){
+			//the old snapshot stays
+			(void)unlink(tmp);
+		}else if(rename(tmp, job->path) == -1){
+			stats.errors++;
+			(void)fprintf(stderr,"persist: couldnt replace %s\n",job->path);
+		}else{
+			stats.snapshots++;
+		}
+	}
+	free_job(job);
+}
+
+static void free_job(PersistJob *job){
+	free(job->data);
+	free(job);
+}
+
+static int uring_setup(void){
+	struct io_uring_params params;
+	(void)memset(&params, 0, sizeof(params));
+	ringFd = (int)syscall(__NR_io_uring_setup, PERSIST_RING, &params);
+	if(ringFd == -1){
+		//old kernel, seccomp or kernel.io_uring_disabled
+		return -1;
+	}
+	sqRingSize = params.sq_off.array + params.sq_entries*sizeof(unsigned int);
+	cqRingSize = params.cq_off.cqes + params.cq_entries*sizeof(struct io_uring_cqe);
+	if(params.features & IORING_FEAT_SINGLE_MMAP){
+		if(cqRingSize > sqRingSize){
+			sqRingSize = cqRingSize;
+		}
+		cqRingSize = sqRingSize;
+	}
+	sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+	if(sqRing == MAP_FAILED){
+		uring_teardown();
+		return -1;
+	}
+	if(params.features & IORING_FEAT_SINGLE_MMAP){
+		cqRing = sqRing;
+	}else{
+		cqRing = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+		if(cqRing == MAP_FAILED){
+			uring_teardown();
+			return -1;
+		}
+	}
+	sqesSize = params.sq_entries*sizeof(struct io_uring_sqe);
+	sqes = mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+	if(sqes == MAP_FAILED){
+		uring_teardown();
+		return -1;
+	}
+	sqTail = (unsigned int*)((char*)sqRing + params.sq_off.tail);
+	sqMask = (unsigned int*)((char*)sqRing + params.sq_off.ring_mask);
+	sqArray = (unsigned int*)((char*)sqRing + params.sq_off.array);
+	cqHead = (unsigned int*)((char*)cqRing + params.cq_off.head);
+	cqTail = (unsigned int*)((char*)cqRing + params.cq_off.tail);
+	cqMask = (unsigned int*)((char*)cqRing + params.cq_off.ring_mask);
+	cqes = (struct io_uring_cqe*)((char*)cqRing + params.cq_off.cqes);
+	cqEntries = params.cq_entries;
+	return 0;
+}
+
+static void uring_teardown(void){
+	if(sqes != MAP_FAILED){
+		(void)munmap(sqes, sqesSize);
+		sqes = MAP_FAILED;
+	}
+	if(cqRing != MAP_FAILED && cqRing != sqRing){
+		(void)munmap(cqRing, cqRingSize);
+	}
+	cqRing = MAP_FAILED;
+	if(sqRing != MAP_FAILED){
+		(void)munmap(sqRing, sqRingSize);
+		sqRing = MAP_FAILED;
+	}
+	if(ringFd != -1){
+		(void)close(ringFd);
+		ringFd = -1;
+	}
+}
+
+static void uring_submit(PersistJob *job){
+	struct io_uring_sqe *sqe;
+	unsigned int tail;
+	//every job holds two completion entries until it is reaped
+	while(inflight > 1 && 2*inflight > cqEntries){
+		stats.ring_full++;
+		uring_reap(1);
+	}
+	tail = *sqTail;
+	sqe = &sqes[tail & *sqMask];
+	(void)memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = job->fd;
+	sqe->addr = (uintptr_t)job->data;
+	sqe->len = job->used;
+	sqe->off = job->offset;
+	//a failed or short write cancels the sync behind it, log writes wait for the ones before
+	sqe->flags = IOSQE_IO_LINK;
+	if(job->kind == PERSIST_LOG){
+		sqe->flags |= IOSQE_IO_DRAIN;
+	}
+	sqe->user_data = (uintptr_t)job;
+	sqArray[tail & *sqMask] = tail & *sqMask;
+	tail++;
+	sqe = &sqes[tail & *sqMask];
+	(void)memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_FSYNC;
+	sqe->fd = job->fd;
+	sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+	sqe->user_data = (uintptr_t)job;
+	sqArray[tail & *sqMask] = tail & *sqMask;
+	tail++;
+	job->pending = 2;
+	//the entries have to be visible before the kernel sees the new tail
+	__sync_synchronize();
+	*sqTail = tail;
+	while(syscall(__NR_io_uring_enter, ringFd, 2, 0, 0, NULL, 0) == -1){
+		if(errno != EINTR && errno != EAGAIN && errno != EBUSY){
+			(void)fprintf(stderr,"persist: io_uring_enter failed with errno %d\n",errno);
+			job->failed = 1;
+			job->pending = 0;
+			inflight--;
+			if(job->kind == PERSIST_LOG){
+				logBusy = 0;
+			}
+			finish_job(job);
+			return;
+		}
+		uring_reap(0);
+	}
+}
+
+static void uring_reap(int wait){
+	unsigned int head;
+	if(wait){
+		while(syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) == -1 && errno == EINTR){
+		}
+	}
+	head = *cqHead;
+	for(;;){
+		struct io_uring_cqe *cqe;
+		PersistJob *job;
+		if(head == *(volatile unsigned int*)cqTail){
+			break;
+		}
+		__sync_synchronize();
+		cqe = &cqes[head & *cqMask];
+		job = (PersistJob*)(uintptr_t)cqe->user_data;
+		//the write of a link always completes before its sync
+		if(job->pending == 2 ? cqe->res != (int)job->used : cqe->res < 0){
+			job->failed = 1;
+		}
+		head++;
+		if(--job->pending == 0){
+			inflight--;
+			if(job->kind == PERSIST_LOG){
+				logBusy = 0;
+			}
+			finish_job(job);
+		}
+	}
+	__sync_synchronize();
+	*cqHead = head;
+}
+
+static void *writer_loop(void *arg){
+	(void)arg;
+	(void)pthread_mutex_lock(&persistLock);
+	for(;;){
+		PersistJob *job;
+		size_t done = 0;
+		while(queue == NULL && !stopping){
+			(void)pthread_cond_wait(&queueCond, &persistLock);
+		}
+		if(queue == NULL){
+			break;
+		}
+		job = queue;
+		queue = job->next;
+		if(queue == NULL){
+			queueTail = NULL;
+		}
+		(void)pthread_mutex_unlock(&persistLock);
+		while(done < job->used){
+			ssize_t written = pwrite(job->fd, job->data + done, job->used - done, job->offset + done);
+			if(written == -1 && errno == EINTR){
+				continue;
+			}
+			if(written <= 0){
+				job->failed = 1;
+				break;
+			}
+			done += written;
+		}
+		if(!job->failed && fdatasync(job->fd) == -1){
+			job->failed = 1;
+		}
+		(void)pthread_mutex_lock(&persistLock);
+		inflight--;
+		if(job->kind == PERSIST_LOG){
+			logBusy = 0;
+			start_next();
+		}
+		finish_job(job);
+		(void)pthread_cond_broadcast(&drainedCond);
+	}
+	(void)pthread_mutex_unlock(&persistLock);
+	return NULL;
+}
@@ -0,0 +1,102 @@
+#ifndef myauthpersist
+#define myauthpersist
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "db.h"
+#include "trace.h"
+
+//records are collected in buffers of this size, each buffer is one write
+#define PERSIST_BUFFER (64*1024)
+//submission queue entries of the ring, every buffer takes two
+#define PERSIST_RING (64)
+//writers of the fallback when io_uring is not available
+#define PERSIST_THREADS (2)
+#define PERSIST_PATH (256)
+
+#define PERSIST_LOG (0)
+#define PERSIST_SNAPSHOT (1)
+
+ /*
+ * one buffer on its way to the disk: written, fdatasynced and,
+ * for snapshots, renamed over the old snapshot once it is durable
+ */
+typedef struct mypersistjobstruct {
+	int kind;
+	int fd;
+	off_t offset;
+	char *data;
+	size_t used;
+	size_t cap;
+	int pending;
+	int failed;
+	char path[PERSIST_PATH];
+	struct mypersistjobstruct *next;
+} PersistJob;
+
+typedef struct mypersiststatsstruct {
+	unsigned long records;
+	unsigned long bytes;
+	unsigned long writes;
+	unsigned long syncs;
+	unsigned long snapshots;
+	unsigned long errors;
+	unsigned long ring_full;
+	unsigned long max_inflight;
+} PersistStats;
+
+ /**
+ * @brief starts the writer, io_uring if the kernel allows it, threads otherwise
+ * @details none of the functions below may be called concurrently,
+ *          the server calls them holding its handler lock
+ * @param logPath change log to append to, NULL to only write snapshots
+ * @return 0 on success, -1 on error with errno set
+ */
+int persist_start(const char *logPath);
+
+ /**
+ * @brief queues the current state of a user for the change log
+ * @param store the store
+ * @param user the user that was registered or changed
+ * @return 0 on success, -1 if malloc failed
+ */
+int persist_user(UserStore *store, unsigned int user);
+
+ /**
+ * @brief hands the queued records to the writer and collects finished writes
+ * @details never waits for the disk unless all ring entries are in flight
+ */
+void persist_flush(void);
+
+ /**
+ * @brief queues a snapshot of all users, replacing path once it is durable
+ * @param store the store
+ * @param path the snapshot file
+ * @return 0 on success, -1 on error
+ */
+int persist_snapshot(UserStore *store, const char *path);
+
+ /**
+ * @brief waits until everything queued is on disk and stops the writer
+ */
+void persist_stop(void);
+
+ /**
+ * @brief name of the writer in use
+ * @return "io_uring", "threads" or "none" before persist_start
+ */
+const char *persist_backend(void);
+
+ /**
+ * @brief counters of the writer
+ * @return the counters, valid until persist_stop
+ */
+PersistStats *persist_stats(void);
+
+#endif
@@ -0,0 +1,202 @@
+/**
+ * @file placement.c
+ * @author David Schrder 1226747
+ * @brief Cpu, numa and huge page placement for server and bench
+ * @details Uses the raw mempolicy syscalls so no libnuma is needed. Every
+ *          setting is best effort, the report functions show what the kernel
+ *          actually did.
+ * @date 08.01.2017
+ */
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "placement.h"
+
+//from linux/mempolicy.h, which clashes with the libc headers
+#define MPOL_BIND (2)
+#define MPOL_F_NODE (1<<0)
+#define MPOL_F_ADDR (1<<1)
+#define MPOL_MF_MOVE (1<<1)
+#define NODE_MASK_BITS (1024)
+
+int placement_huge = 0;
+int placement_numa_node = -1;
+
+ /**
+ * @brief builds a node mask with only the chosen node set
+ * @param mask array of NODE_MASK_BITS bits
+ */
+static void node_mask(unsigned long *mask){
+	(void)memset(mask, 0, NODE_MASK_BITS/8);
+	mask[placement_numa_node/(8*sizeof(unsigned long))] = 1UL << (placement_numa_node%(8*sizeof(unsigned long)));
+}
+
+int placement_pin(const char *cpulist){
+	cpu_set_t set;
+	const char *pos = cpulist;
+	CPU_ZERO(&set);
+	while(*pos != '\0'){
+		char *end;
+		long first = strtol(pos,&end,10);
+		long last = first;
+		if(end == pos || first < 0 || first >= CPU_SETSIZE){
+			return -1;
+		}
+		if(*end == '-'){
+			pos = end+1;
+			last = strtol(pos,&end,10);
+			if(end == pos || last < first || last >= CPU_SETSIZE){
+				return -1;
+			}
+		}
+		for(;first<=last;first++){
+			CPU_SET(first,&set);
+		}
+		if(*end == ','){
+			end++;
+		}else if(*end != '\0'){
+			return -1;
+		}
+		pos = end;
+	}
+	if(CPU_COUNT(&set) == 0){
+		return -1;
+	}
+	return sched_setaffinity(0, sizeof(set), &set);
+}
+
+int placement_node(int node){
+	unsigned long mask[NODE_MASK_BITS/(8*sizeof(unsigned long))];
+	if(node < 0 || node >= NODE_MASK_BITS){
+		return -1;
+	}
+	placement_numa_node = node;
+	node_mask(mask);
+	return syscall(SYS_set_mempolicy, MPOL_BIND, mask, NODE_MASK_BITS) == -1 ? -1 : 0;
+}
+
+int placement_bind(void *addr, size_t len){
+	int result = 0;
+	if(placement_numa_node >= 0){
+		unsigned long mask[NODE_MASK_BITS/(8*sizeof(unsigned long))];
+		node_mask(mask);
+		if(syscall(SYS_mbind, addr, len, MPOL_BIND, mask, NODE_MASK_BITS, MPOL_MF_MOVE) == -1){
+			result = -1;
+		}
+	}
+	if(placement_huge){
+		if(madvise(addr, len, MADV_HUGEPAGE) == -1){
+			result = -1;
+		}
+	}
+	return result;
+}
+
+size_t placement_round(size_t size){
+	if(!placement_huge){
+		return size;
+	}
+	return (size + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+}
+
+void *placement_grow(void *old, size_t oldSize, size_t newSize){
+	void *grown;
+	if(!placement_huge){
+		return realloc(old, newSize);
+	}
+	oldSize = placement_round(oldSize);
+	newSize = placement_round(newSize);
+	if(old != NULL && newSize <= oldSize){
+		return old;
+	}
+	//reserved hugetlb pages first, transparent huge pages otherwise
+	grown = mmap(NULL, newSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if(grown == MAP_FAILED){
+		grown = mmap(NULL, newSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(grown == MAP_FAILED){
+			return NULL;
+		}
+		(void)placement_bind(grown, newSize);
+	}
+	if(old != NULL){
+		(void)memcpy(grown, old, oldSize);
+		(void)munmap(old, oldSize);
+	}
+	return grown;
+}
+
+void placement_free(void *ptr, size_t size){
+	if(ptr == NULL){
+		return;
+	}
+	if(!placement_huge){
+		free(ptr);
+		return;
+	}
+	(void)munmap(ptr, placement_round(size));
+}
+
+void placement_report_process(FILE *out, const char *name){
+	cpu_set_t set;
+	int cpu;
+	int first = 1;
+	(void)fprintf(out,"%s placement: cpus ",name);
+	if(sched_getaffinity(0, sizeof(set), &set) == 0){
+		for(cpu=0;cpu<CPU_SETSIZE;cpu++){
+			if(CPU_ISSET(cpu,&set)){
+				(void)fprintf(out,first?"%d":",%d",cpu);
+				first = 0;
+			}
+		}
+	}else{
+		(void)fprintf(out,"unknown");
+	}
+	(void)fprintf(out,", running on cpu %d",sched_getcpu());
+	if(placement_numa_node >= 0){
+		(void)fprintf(out,", memory bound to numa node %d\n",placement_numa_node);
+	}else{
+		(void)fprintf(out,", default numa policy\n");
+	}
+}
+
+void placement_report_region(FILE *out, const char *name, void *addr){
+	int node = -1;
+	long kernelPage = -1;
+	long huge = 0;
+	unsigned long target = (unsigned long)addr;
+	int inside = 0;
+	char line[256];
+	FILE *smaps;
+	if(syscall(SYS_get_mempolicy, &node, NULL, 0, addr, MPOL_F_NODE | MPOL_F_ADDR) == -1){
+		node = -1;
+	}
+	if((smaps = fopen("/proc/self/smaps","r"))){
+		while(fgets(line, sizeof(line), smaps) != NULL){
+			unsigned long start;
+			unsigned long end;
+			long kb;
+			if(sscanf(line,"%lx-%lx ",&start,&end) == 2 && strchr(line,'-') < strchr(line,' ')){
+				if(inside){
+					break;
+				}
+				inside = target >= start && target < end;
+			}else if(inside){
+				if(sscanf(line,"KernelPageSize: %ld kB",&kb) == 1){
+					kernelPage = kb;
+				}else if(sscanf(line,"AnonHugePages: %ld kB",&kb) == 1
+					|| sscanf(line,"ShmemPmdMapped: %ld kB",&kb) == 1
+					|| sscanf(line,"FilePmdMapped: %ld kB",&kb) == 1){
+					huge += kb;
+				}
+			}
+		}
+		(void)fclose(smaps);
+	}
+	(void)fprintf(out,"%s placement: numa node %d, page size %ld kB, %ld kB in huge pages%s\n"
+		,name,node,kernelPage,huge,placement_huge && huge == 0 && kernelPage <= 4 ? " (huge pages requested but not granted)" : "");
+}
@@ -0,0 +1,78 @@
+#ifndef myplacement
+#define myplacement
+#include <stdio.h>
+#include <stddef.h>
+
+//size of a transparent or hugetlb huge page on x86_64
+#define HUGE_PAGE (2*1024*1024)
+
+ /*
+ * set by -H, placement_grow and placement_round then use huge pages
+ */
+extern int placement_huge;
+
+ /*
+ * numa node set by placement_node, -1 if none was chosen
+ */
+extern int placement_numa_node;
+
+ /**
+ * @brief pins the calling process to the given cpus
+ * @param cpulist comma separated cpus or ranges, for example 0,2-3
+ * @return 0 on success, -1 on error
+ */
+int placement_pin(const char *cpulist);
+
+ /**
+ * @brief binds all further allocations of the process to a numa node
+ * @param node the node to allocate on
+ * @return 0 on success, -1 on error
+ */
+int placement_node(int node);
+
+ /**
+ * @brief applies the chosen node and huge page setting to a mapping before it is touched
+ * @param addr start of the mapping
+ * @param len length of the mapping
+ * @return 0 on success, -1 if one of the settings was refused
+ */
+int placement_bind(void *addr, size_t len);
+
+ /**
+ * @brief rounds a mapping size up to whole huge pages if huge pages are enabled
+ * @param size the size to round
+ */
+size_t placement_round(size_t size);
+
+ /**
+ * @brief realloc for large arrays, backed by huge pages if enabled
+ * @param old the array to grow or NULL
+ * @param oldSize size of the old array in bytes
+ * @param newSize size of the new array in bytes
+ * @return the new array or NULL on error, old is untouched then
+ */
+void *placement_grow(void *old, size_t oldSize, size_t newSize);
+
+ /**
+ * @brief frees an array allocated by placement_grow
+ * @param ptr the array or NULL
+ * @param size its size in bytes
+ */
+void placement_free(void *ptr, size_t size);
+
+ /**
+ * @brief prints the cpus the process may run on and the cpu it runs on now
+ * @param out stream to print to
+ * @param name name of the process
+ */
+void placement_report_process(FILE *out, const char *name);
+
+ /**
+ * @brief prints the numa node and page sizes that back a memory region
+ * @param out stream to print to
+ * @param name description of the region
+ * @param addr an address inside the region
+ */
+void placement_report_region(FILE *out, const char *name, void *addr);
+
+#endif
@@ -0,0 +1,224 @@
+/**
+ * @file replica.c
+ * @author David Schrder 1226747
+ * @brief Hot standby of the auth server
+ * @details A standby follows the change log the primary writes with -L, woken
+ *          by inotify, and watches the pid the primary published in the shared
+ *          memory header. Once that process is gone the standby applies what is
+ *          left of the log and the server takes over the shm names.
+ * @date 08.01.2017
+ */
+#include "replica.h"
+
+ /**
+ * @brief applies all complete records appended since the last call
+ * @param fd the log
+ * @param store the store to apply to
+ * @param stats counters to update
+ * @param errmsg set to a description of the failure
+ * @return 0 on success, -1 on error
+ */
+static int catch_up(int fd, UserStore *store, ReplicaStats *stats, const char **errmsg);
+
+ /**
+ * @brief checks whether a primary is serving
+ * @return 1 if a primary is running or still starting up, 0 if there is none
+ */
+static int primary_alive(void);
+
+ /**
+ * @brief prints the counters
+ * @param stats the counters
+ * @param lag bytes of the log not applied yet
+ */
+static void report(ReplicaStats *stats, long long lag);
+
+ /*
+ * the log read so far, a torn record stays in buffer until its rest arrives
+ */
+static char buffer[REPLICA_CHUNK];
+static size_t buffered;
+static off_t applied;
+
+ /*
+ * pid read from the header, 0 while none was seen
+ */
+static pid_t primary;
+
+int replica_follow(UserStore *store, const char *path, volatile sig_atomic_t *quit, ReplicaStats *stats, const char **errmsg){
+	int fd;
+	int notify;
+	long long lastReport = trace_now();
+	//created empty if the primary did not write yet, it never truncates
+	fd = open(path, O_RDONLY | O_CREAT, 0666);
+	if(fd == -1){
+		*errmsg = "couldnt open change log";
+		return -1;
+	}
+	//without inotify the poll timeout alone paces the loop
+	notify = inotify_init();
+	if(notify != -1 && inotify_add_watch(notify, path, IN_MODIFY) == -1){
+		(void)close(notify);
+		notify = -1;
+	}
+	for(;;){
+		struct pollfd pfd;
+		if(catch_up(fd,store,stats,errmsg)==-1){
+			break;
+		}
+		if(*quit){
+			(void)close(fd);
+			if(notify != -1){
+				(void)close(notify);
+			}
+			return 1;
+		}
+		if(!primary_alive()){
+			//everything the primary wrote before it exited
+			int result = catch_up(fd,store,stats,errmsg);
+			(void)close(fd);
+			if(notify != -1){
+				(void)close(notify);
+			}
+			return result;
+		}
+		if(trace_now()-lastReport >= REPLICA_REPORT_NS){
+			struct stat st;
+			if(fstat(fd,&st)==0){
+				report(stats,(long long)(st.st_size-applied));
+			}
+			lastReport = trace_now();
+		}
+		pfd.fd = notify;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if(poll(&pfd, notify != -1 ? 1 : 0, REPLICA_POLL_MS) > 0){
+			char events[4096];
+			//the events only wake us, catch_up looks at the file itself
+			(void)read(notify, events, sizeof(events));
+			stats->wakeups++;
+		}
+	}
+	(void)close(fd);
+	if(notify != -1){
+		(void)close(notify);
+	}
+	return -1;
+}
+
+void replica_release_stale(void){
+	struct stat st;
+	MySegment *stale;
+	int fd = shm_open(SHM_NAME, O_RDWR, PERMISSION);
+	if(fd != -1){
+		if(fstat(fd,&st)==0 && st.st_size >= (off_t)sizeof *stale){
+			stale = mmap(NULL, sizeof *stale, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if(stale != MAP_FAILED){
+				if(stale->header.magic == SHM_MAGIC && stale->header.layout == SHM_LAYOUT_VERSION){
+					int i;
+					sem_t *c_w_sem;
+					//same as a shutdown of the primary, waiting clients give up
+					stale->state = -1;
+					for(i=0;i<SHM_SLOTS;i++){
+						if(stale->slot[i].phase!=SLOT_FREE){
+							(void)sem_post(&stale->slot[i].done);
+						}
+					}
+					c_w_sem = sem_open(CLIENT_WRITE_SEM, 0);
+					if(c_w_sem != SEM_FAILED){
+						(void)sem_post(c_w_sem);
+						(void)sem_close(c_w_sem);
+					}
+				}
+				(void)munmap(stale, sizeof *stale);
+			}
+		}
+		(void)close(fd);
+	}
+	(void)shm_unlink(SHM_NAME);
+	(void)sem_unlink(CLIENT_WRITE_SEM);
+	(void)sem_unlink(SERVER_SEM);
+}
+
+static int catch_up(int fd, UserStore *store, ReplicaStats *stats, const char **errmsg){
+	for(;;){
+		ssize_t got;
+		ssize_t used;
+		long long begin;
+		struct stat st;
+		got = pread(fd, buffer+buffered, sizeof(buffer)-buffered, applied+buffered);
+		if(got == -1){
+			if(errno == EINTR){
+				continue;
+			}
+			*errmsg = "couldnt read change log";
+			return -1;
+		}
+		if(got == 0){
+			return 0;
+		}
+		if(fstat(fd,&st)==0 && st.st_size-applied > stats->max_lag){
+			stats->max_lag = st.st_size-applied;
+		}
+		buffered += got;
+		begin = trace_now();
+		used = apply_records(store,buffer,buffered,&stats->records,errmsg);
+		if(used == -1){
+			return -1;
+		}
+		//an unfinished record or a hole is read again next time
+		stats->bytes += used;
+		applied += used;
+		buffered -= used;
+		(void)memmove(buffer, buffer+used, buffered);
+		stats->apply_ns += trace_now()-begin;
+		if(buffered == sizeof(buffer)){
+			*errmsg = "change log holds a record longer than a chunk";
+			return -1;
+		}
+	}
+}
+
+static int primary_alive(void){
+	MyShmHeader *header;
+	struct stat st;
+	int fd;
+	if(primary != 0){
+		return kill(primary, 0) == 0 || errno != ESRCH;
+	}
+	fd = shm_open(SHM_NAME, O_RDONLY, PERMISSION);
+	if(fd == -1){
+		return 0;
+	}
+	if(fstat(fd,&st) == -1 || st.st_size < (off_t)sizeof *header){
+		//still sizing its segment
+		(void)close(fd);
+		return 1;
+	}
+	header = mmap(NULL, sizeof *header, PROT_READ, MAP_SHARED, fd, 0);
+	(void)close(fd);
+	if(header == MAP_FAILED){
+		return 1;
+	}
+	if(header->magic == SHM_MAGIC){
+		__sync_synchronize();
+		if(header->layout == SHM_LAYOUT_VERSION){
+			primary = header->pid;
+		}
+	}
+	(void)munmap(header, sizeof *header);
+	//a segment without magic is a primary starting up
+	return primary == 0 || kill(primary, 0) == 0 || errno != ESRCH;
+}
+
+static void report(ReplicaStats *stats, long long lag){
+	static unsigned long reported;
+	if(stats->records == reported && lag == 0){
+		return;
+	}
+	reported = stats->records;
+	(void)fprintf(stdout,"standby records:%lu bytes:%lu lag:%lld bytes max lag:%lld bytes apply rate:%.0f records/s\n"
+		,stats->records,stats->bytes,lag,stats->max_lag
+		,stats->apply_ns>0?stats->records*1e9/stats->apply_ns:0.0);
+	(void)fflush(stdout);
+}
@@ -0,0 +1,53 @@
+#ifndef myauthreplica
+#define myauthreplica
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/inotify.h>
+#include "myshared.h"
+#include "db.h"
+#include "trace.h"
+
+//bytes read from the log at once, a record never spans more than DB_LINE
+#define REPLICA_CHUNK (64*1024)
+//longest sleep between two looks at the log and the primary
+#define REPLICA_POLL_MS (20)
+//a progress line is printed at most this often
+#define REPLICA_REPORT_NS (1000000000LL)
+
+typedef struct myreplicastatsstruct {
+	unsigned long records;
+	unsigned long bytes;
+	unsigned long wakeups;
+	long long max_lag;
+	long long apply_ns;
+} ReplicaStats;
+
+ /**
+ * @brief applies the change log of a primary until the primary is gone
+ * @details the log is applied from its start on top of the store, afterwards
+ *          every record the primary appends. Returns once the primary has exited
+ *          and the rest of the log is applied
+ * @param store the store to apply to
+ * @param path the change log of the primary
+ * @param quit stops following when set
+ * @param stats counters to update
+ * @param errmsg set to a description of the failure
+ * @return 0 once the primary is gone, 1 if quit was set, -1 on error
+ */
+int replica_follow(UserStore *store, const char *path, volatile sig_atomic_t *quit, ReplicaStats *stats, const char **errmsg);
+
+ /**
+ * @brief wakes the clients still waiting on the segment of a dead primary and removes its names
+ */
+void replica_release_stale(void);
+
+#endif
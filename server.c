@@ -25,64 +25,104 @@ static void bailout(int exitcode, const char *errmsg);
  */
 static void allocate_ressources(void);
 
+ /**
+ * @brief pins the server and binds its memory as requested by -c and -N
+ */
+static void apply_placement(void);
+
+ /**
+ * @brief runs as standby of the primary writing logPath until it is gone
+ * @details returns with the whole log applied, ready to take over
+ */
+static void follow_primary(void);
+
  /**
  * @brief tries to free all ressources
  */
 static void free_ressources(void);
 
  /**
- * @brief inserts a data given via pointer into the list
- * @param list the list to insert into
- * @param data the object to insert into the list
+ * @brief fills the reply page with users starting at the requested cursor
+ * @param req the request holding the cursor
+ * @param resp the reply to fill
+ * @param withSecrets 1 to write login;secret lines, 0 to write logins only
  */
-static void insert(List list, void *data);
+static void fill_page(MyRequest *req, MyResponse *resp, int withSecrets);
 
  /**
- * @brief frees all list elements memory
- * @param list the list to clear
+ * @brief waits for semaphore and exits gracefully in case of signal
+ * @param sem semaphore to wait on
+ * @param timeout ns to wait at most
+ * @param description semaphore description that is printed in case of error
+ * @return 0 once posted, -1 if the timeout passed
  */
-static void emptyList(List list);
+static int wait_for_sem(sem_t *sem, long long timeout, char *description);
 
  /**
- * @brief dumps the db into csv
+ * @brief takes back the slots and sessions of clients that are gone
+ * @details a slot whose request is ready is left to drain_requests first,
+ *          sessions are checked RECOVERY_SESSIONS at a time
  */
-static void dumpdb(void);
+static void recover_dead_clients(void);
 
  /**
- * @brief same as strcpy but adds tailing null byte after size-1 chars
- * @param dest string to copy to
- * @param source string to copy from
- * @param size maximum size including null byte
+ * @brief checks whether a client process is gone
+ * @param pid pid of the client
+ * @return 1 if no such process exists, 0 otherwise
  */
-static void mystrcpy(char *dest, char *source, int size);
+static int client_gone(pid_t pid);
 
  /**
- * @brief waits for semaphore and exits gracefully in case of signal
- * @param sem semaphore to wait on
- * @param description semaphore description that is printed in case of error
+ * @brief handles all requests that are ready and posts their replies
+ * @details replies are posted after the whole pass so clients are woken in one go
+ * @return number of requests handled
+ */
+static int drain_requests(void);
+
+ /**
+ * @brief checks whether any slot holds a request that is not handled yet
+ * @return 1 if a request is pending, 0 otherwise
+ */
+static int pending_requests(void);
+
+ /**
+ * @brief executes a request and writes the reply, shared by shm and socket transport
+ * @details callers have to hold handlerLock
+ * @param req the request
+ * @param resp the reply to fill
+ * @param owner pid of the client, sessions it opens are dropped once it is gone
+ */
+static void handle_request(MyRequest *req, MyResponse *resp, pid_t owner);
+
+ /**
+ * @brief publishes that the secret of a user changed
+ * @param user the user whose secret was written
+ * @return the new generation of the users generation slot
  */
-static void wait_for_sem(sem_t *sem, char *description);
+static unsigned int bump_generation(unsigned int user);
 
  /**
- * @brief searches the database for a myDbObject with the given username
- * @param list list of db entries
- * @param username username to search for
+ * @brief takes the handler lock, exits on error
  */
-static myDbObject *search_for(List list, char *username);
+static void lock_handlers(void);
 
  /**
- * @brief searches the database for a session object with the given sessionid
- * @param list list of sessions
- * @param sessionid sessionid to look for 
+ * @brief releases the handler lock, exits on error
  */
-static session *get_session(List list, int sessionid);
+static void unlock_handlers(void);
 
  /**
- * @brief drops a session from the db
- * @param list list of sessions
- * @param sessionid sessionid to look for
+ * @brief prints a request log line to stdout
+ * @param fmt printf format of the line
  */
-static void drop_session(List list, int sessionid);
+static void log_request(const char *fmt, ...);
+
+ /**
+ * @brief resets the reply fields and echoes the request sequence number
+ * @param req the request
+ * @param resp the reply to reset
+ */
+static void reset_response(MyRequest *req, MyResponse *resp);
 
  /**
  * @brief handles the given signal
@@ -97,20 +137,76 @@ static char *myname;
  /*
  * shared memory for communication with the clients
  */
-static MyShm *shared;
-static int shmfd;
+static MySegment *shared;
+static size_t shmSize;
+static int shmfd = -1;
 volatile sig_atomic_t quit = 0;
 
  /*
  * semaphore for synchronization
  */
 static sem_t *s_sem;
-static sem_t *c_r_sem;
 static sem_t *c_w_sem;
 
-static List db;
+ /*
+ * set for each name allocate_ressources created, only those are unlinked on exit
+ */
+static int createdShm;
+static int createdServerSem;
+static int createdWriteSem;
+
+static UserStore store;
 
-static List users;
+static SessionTable sessions;
+
+ /*
+ * set once the database and log are loaded, only then the snapshot may replace the file
+ */
+static int loaded;
+
+ /*
+ * set by -x, allows EXPORT_USERS to hand out secrets
+ */
+static int exportAllowed;
+
+ /*
+ * database given by -l, loaded once the placement is applied
+ */
+static char *dbPath;
+
+ /*
+ * change log given by -L, replayed on top of the database and appended to
+ */
+static char *logPath;
+
+ /*
+ * set by -S, follow the primary writing logPath and take over once it is gone
+ */
+static int standby;
+static long long takeoverBegin;
+
+ /*
+ * socket given by -U, served next to the shm slots
+ */
+static char *sockPath;
+
+ /*
+ * serializes handle_request between the shm loop and the socket thread
+ */
+static pthread_mutex_t handlerLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t lockOwner;
+static volatile int lockOwned;
+
+ /*
+ * position in the session table the next look for dead owners starts at
+ */
+static unsigned int recoveryCursor;
+
+ /*
+ * placement options, -c cpus and -N node, -H sets placement_huge
+ */
+static char *cpuList;
+static int numaNode = -1;
 
 /**
  * @brief Program entry point
@@ -121,6 +217,8 @@ static List users;
  */
 int main(int argc, char **argv){
 	struct sigaction s;
+	long long nextRecovery;
+	int posted;
 	s. sa_handler = handle_signal ;
 	s. sa_flags = 0 ;
 	if(sigemptyset (&s. sa_mask )==-1){
@@ -135,143 +233,379 @@ int main(int argc, char **argv){
 	if(sigaction (SIGTERM , &s, NULL )==-1){
 		bailout(EXIT_FAILURE,"error on sigaction initialization");
 	}
+	if(sigaction (SIGUSR1 , &s, NULL )==-1){
+		bailout(EXIT_FAILURE,"error on sigaction initialization");
+	}
+	trace_init("auth-server");
 	if(atexit(free_ressources)!=0){
 		bailout(EXIT_FAILURE,"couldnt set atexit");
 	}
-	allocate_ressources();
 	parse_args(argc,argv);
-	
+	apply_placement();
+	//initialize db, allocated on the first user and session
+	store_init(&store);
+	sessions_init(&sessions);
+	if(dbPath != NULL){
+		const char *errmsg;
+		if(load_db(&store,dbPath,&errmsg)==-1){
+			(void)fprintf(stderr,"%s %s: %s\n",myname,dbPath,errmsg);
+			bailout(EXIT_FAILURE,"usage auth-server [-l database] [-L log [-S]] [-x] [-U socket] [-H] [-c cpus] [-N node]");
+		}
+	}
+	if(standby){
+		follow_primary();
+	}else if(logPath != NULL){
+		const char *errmsg;
+		if(replay_log(&store,logPath,&errmsg)==-1){
+			(void)fprintf(stderr,"%s %s: %s\n",myname,logPath,errmsg);
+			bailout(EXIT_FAILURE,"couldnt replay change log");
+		}
+	}
+	allocate_ressources();
+	if(persist_start(logPath)==-1){
+		(void)fprintf(stderr,"%s %s: errno %d\n",myname,logPath != NULL ? logPath : "writer",errno);
+		bailout(EXIT_FAILURE,"couldnt start persistence");
+	}
+	(void)fprintf(stdout,"persistence: %s, log %s\n",persist_backend(),logPath != NULL ? logPath : "off");
+	loaded = 1;
+	if(sockPath != NULL && sock_start(sockPath,handle_request,lock_handlers,unlock_handlers,&shared->sockStats)==-1){
+		(void)fprintf(stderr,"%s %s: errno %d\n",myname,sockPath,errno);
+		bailout(EXIT_FAILURE,"couldnt listen on unix socket");
+	}
+	if(standby){
+		(void)fprintf(stdout,"standby took over in %.2f ms\n",(trace_now()-takeoverBegin)/1e6);
+	}
+	placement_report_process(stdout,"auth-server");
+	placement_report_region(stdout,"shared memory",shared);
+	if(store.login != NULL){
+		placement_report_region(stdout,"user store",store.login);
+	}
 	
 	shared->state = 0;
 	srand(time(NULL));
-	wait_for_sem(s_sem,"server sem");
+	nextRecovery = trace_now() + RECOVERY_INTERVAL_NS;
 	while(!quit){
-		switch(shared->command){
-			case REGISTER:
-				if(search_for(db,shared->login)!=NULL){
-					(void)memset(shared, 0, sizeof(MyShm));
-					shared->state = 1;
-				}else{
-					myDbObject *new;
-					if((new = (myDbObject*) malloc(sizeof(myDbObject)))==NULL){
-						bailout(EXIT_FAILURE,"malloc failed");
-					}
-					mystrcpy(new->login,shared->login,20);
-					mystrcpy(new->pass,shared->pass,20);
-					new->secret[0]='\0';
-					insert(db,new);
-					(void)memset(shared, 0, sizeof(MyShm));
-					shared->state = 0;
-					(void)fprintf(stdout,"registered:%s\n",new->login);
-				}
-				
-				int c = sem_post(c_r_sem);
-				if(c!= 0){
-					bailout(EXIT_FAILURE,"client read semaphore error");
-				}
-			break;
-			case LOGIN:{
-				myDbObject *userObj = (myDbObject*) search_for(db,shared->login);
-				if(userObj != NULL){
-					if(strcmp(shared->pass,userObj->pass)==0){
-						session *new;
-						if((new = (session*) malloc(sizeof(session)))==NULL){
-						bailout(EXIT_FAILURE,"malloc failed");
-						}
-						mystrcpy(new->login,shared->login,20);
-						new->userid = rand();
-						while(get_session(users,new->userid)){
-							new->userid = rand();
-						}
-						insert(users,new);
-						(void)memset(shared, 0, sizeof(MyShm));
-						shared->sessId = new->userid;
-						shared->state = 0;
-						(void)fprintf(stdout,"logged in:%s with session id:%d\n",new->login,new->userid);
-					}else{
-						(void)memset(shared, 0, sizeof(MyShm));
-						shared->state = 1;
-					}
-				}else{
-					(void)memset(shared, 0, sizeof(MyShm));
-					shared->state = 1;
-				}
-				
-				int c = sem_post(c_r_sem);
-				if(c!= 0){
-					bailout(EXIT_FAILURE,"client write semaphore error");
+		trace_poll();
+		if(trace_now() >= nextRecovery){
+			recover_dead_clients();
+			nextRecovery = trace_now() + RECOVERY_INTERVAL_NS;
+		}
+		if(drain_requests()>0){
+			continue;
+		}
+		shared->sleeping = 1;
+		__sync_synchronize();
+		if(pending_requests()){
+			//a client may already be posting, that only costs a spurious wakeup
+			(void)__sync_bool_compare_and_swap(&shared->sleeping,1,0);
+			continue;
+		}
+		TRACE_BEGIN(waitBegin);
+		//a client that died before posting must not keep the server asleep
+		posted = wait_for_sem(s_sem,nextRecovery-trace_now(),"server sem")==0;
+		TRACE_END("wait",waitBegin,-1);
+		shared->sleeping = 0;
+		if(posted){
+			shared->stats.server_wakeups++;
+		}
+	}
+	if(quit){
+		bailout(EXIT_FAILURE,"server closing due to signal");
+	}
+	bailout(EXIT_FAILURE,"returned?");
+	
+	
+
+}
+
+static int pending_requests(void){
+	int i;
+	for(i=0;i<SHM_SLOTS;i++){
+		if(shared->slot[i].phase==SLOT_READY){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int drain_requests(void){
+	int i;
+	int handled = 0;
+	int done[SHM_SLOTS];
+	for(i=0;i<SHM_SLOTS;i++){
+		done[i] = 0;
+		if(shared->slot[i].phase==SLOT_READY){
+			MyShm *slot = &shared->slot[i];
+			__sync_synchronize();
+			if(handled == 0){
+				lock_handlers();
+			}
+			TRACE_BEGIN(requestBegin);
+			handle_request(&slot->req,&slot->resp,slot->owner);
+			TRACE_END("request",requestBegin,slot->req.command);
+			__sync_synchronize();
+			slot->phase = SLOT_DONE;
+			done[i] = 1;
+			handled++;
+		}
+	}
+	if(handled==0){
+		return 0;
+	}
+	unlock_handlers();
+	//replies of one pass are posted together
+	TRACE_BEGIN(postBegin);
+	for(i=0;i<SHM_SLOTS;i++){
+		if(done[i]){
+			if(sem_post(&shared->slot[i].done)!=0){
+				bailout(EXIT_FAILURE,"client reply semaphore error");
+			}
+			shared->stats.server_reply_posts++;
+		}
+	}
+	TRACE_END("reply_posts",postBegin,-1);
+	shared->stats.requests += handled;
+	shared->stats.server_passes++;
+	return handled;
+}
+
+static void reset_response(MyRequest *req, MyResponse *resp){
+	TRACE_BEGIN(begin);
+	//the fixed fields and the whole secret, a slot still holds the reply of its last client.
+	//page is only valid up to count entries, so only its start is cleared
+	resp->seq = req->seq;
+	resp->state = 0;
+	resp->sessId = 0;
+	resp->version = 0;
+	resp->cursor = 0;
+	resp->count = 0;
+	resp->genSlot = 0;
+	resp->generation = 0;
+	(void)memset(resp->secret, 0, sizeof(resp->secret));
+	resp->page[0] = '\0';
+	TRACE_END("reset_response",begin,-1);
+}
+
+static void lock_handlers(void){
+	if(pthread_mutex_lock(&handlerLock)!=0){
+		bailout(EXIT_FAILURE,"couldnt lock handlers");
+	}
+	lockOwner = pthread_self();
+	lockOwned = 1;
+}
+
+static void unlock_handlers(void){
+	//changes of the batch go to the writer together
+	persist_flush();
+	shared->stats.db_users = store.count;
+	shared->stats.db_sessions = sessions.count;
+	shared->stats.db_user_bytes = store_bytes(&store);
+	shared->stats.db_session_bytes = sessions_bytes(&sessions);
+	lockOwned = 0;
+	if(pthread_mutex_unlock(&handlerLock)!=0){
+		bailout(EXIT_FAILURE,"couldnt unlock handlers");
+	}
+}
+
+static unsigned int bump_generation(unsigned int user){
+	volatile unsigned int *gen = &shared->generation[user % SHM_GENERATIONS];
+	//the new secret has to be visible before clients see the new generation
+	__sync_synchronize();
+	*gen = *gen + 1;
+	return *gen;
+}
+
+static void log_request(const char *fmt, ...){
+	va_list args;
+	TRACE_BEGIN(begin);
+	va_start(args, fmt);
+	(void)vfprintf(stdout, fmt, args);
+	va_end(args);
+	TRACE_END("log",begin,-1);
+}
+
+static void handle_request(MyRequest *req, MyResponse *resp, pid_t owner){
+	//the client fills the strings, the store only takes them up to their width
+	req->login[LOGIN_LEN-1] = '\0';
+	req->pass[PASS_LEN-1] = '\0';
+	req->secret[SECRET_LEN-1] = '\0';
+	switch(req->command){
+		case REGISTER:
+			//whatever is accepted has to be replayable from the log and snapshot
+			if(req->login[0]=='\0' || !storable_field(req->login) || !storable_field(req->pass)
+				|| search_for(&store,req->login)!=DB_NO_USER){
+				reset_response(req,resp);
+				resp->state = 1;
+			}else{
+				unsigned int user = add_user(&store,req->login,req->pass,"",0);
+				if(user == DB_NO_USER || persist_user(&store,user)==-1){
+					bailout(EXIT_FAILURE,"malloc failed");
 				}
+				reset_response(req,resp);
+				resp->state = 0;
+				log_request("registered:%s\n",user_login(&store,user));
 			}
-			break;
-			case WRITE_SECRET:{
-				session *sess = (session*) get_session(users,shared->sessId);
-				if(strcmp(sess->login,shared->login)==0){
-					myDbObject *userObj = (myDbObject*) search_for(db,shared->login);
-					mystrcpy(userObj->secret,shared->secret,50);
-					(void)memset(shared, 0, sizeof(MyShm));
-					shared->state = 0;
-					(void)fprintf(stdout,"user: %s wrote secret:%s\n",userObj->login,userObj->secret);
+		break;
+		case LOGIN:{
+			long long now = trace_now();
+			int throttled = throttle_check(req->login,now);
+			if(throttled != THROTTLE_NONE){
+				//refused before the lookup so a guessing client costs no password compare
+				if(throttled == THROTTLE_LOGIN){
+					shared->stats.login_throttled_login++;
 				}else{
-					(void)memset(shared, 0, sizeof(MyShm));
-					shared->state = 1;
+					shared->stats.login_throttled_global++;
 				}
-				int c = sem_post(c_r_sem);
-				if(c!= 0){
-					bailout(EXIT_FAILURE,"client write semaphore error");
+				reset_response(req,resp);
+				resp->state = STATE_THROTTLED;
+				break;
+			}
+			unsigned int user = search_for(&store,req->login);
+			if(user != DB_NO_USER && strcmp(req->pass,user_pass(&store,user))==0){
+				session *new = add_session(&sessions,user,owner);
+				if(new == NULL){
+					bailout(EXIT_FAILURE,"malloc failed");
 				}
+				reset_response(req,resp);
+				resp->sessId = new->id;
+				resp->genSlot = user % SHM_GENERATIONS;
+				resp->state = 0;
+				log_request("logged in:%s with session id:%d\n",user_login(&store,user),new->id);
+			}else{
+				throttle_failed(req->login,now);
+				shared->stats.login_failures++;
+				reset_response(req,resp);
+				resp->state = 1;
 			}
-			break;
-			case READ_SECRET:{
-				session *sess = (session*) get_session(users,shared->sessId);
-				if(strcmp(sess->login,shared->login)==0){
-					myDbObject *userObj = (myDbObject*) search_for(db,shared->login);
-					(void)memset(shared, 0, sizeof(MyShm));
-					mystrcpy(shared->secret,userObj->secret,50);
-					shared->state = 0;
-					(void)fprintf(stdout,"user: %s read secret:%s\n",userObj->login,userObj->secret);
-				}else{
-					(void)memset(shared, 0, sizeof(MyShm));
-					shared->state = 1;
+		}
+		break;
+		case WRITE_SECRET:{
+			session *sess = get_session(&sessions,req->sessId);
+			if(sess != NULL && strcmp(user_login(&store,sess->user),req->login)==0 && storable_field(req->secret)){
+				unsigned int user = sess->user;
+				if(set_secret(&store,user,req->secret)==-1){
+					bailout(EXIT_FAILURE,"malloc failed");
 				}
-				int c = sem_post(c_r_sem);
-				if(c!= 0){
-					bailout(EXIT_FAILURE,"client write semaphore error");
+				store.version[user]++;
+				if(persist_user(&store,user)==-1){
+					bailout(EXIT_FAILURE,"malloc failed");
 				}
+				reset_response(req,resp);
+				resp->version = store.version[user];
+				resp->generation = bump_generation(user);
+				resp->state = 0;
+				log_request("user: %s wrote secret:%s\n",user_login(&store,user),user_secret(&store,user));
+			}else{
+				reset_response(req,resp);
+				resp->state = 1;
 			}
-			break;
-			case LOGOUT:{
-				session *sess = (session*) get_session(users,shared->sessId);
-				if(strcmp(sess->login,shared->login)==0){
-					drop_session(users,sess->userid);
-					(void)memset(shared, 0, sizeof(MyShm));
-					shared->state = 0;
-					(void)fprintf(stdout,"logged out user: %s session id:%d\n",sess->login,sess->userid);
+		}
+		break;
+		case READ_SECRET:{
+			session *sess = get_session(&sessions,req->sessId);
+			if(sess != NULL && strcmp(user_login(&store,sess->user),req->login)==0){
+				unsigned int user = sess->user;
+				reset_response(req,resp);
+				mystrcpy(resp->secret,user_secret(&store,user),SECRET_LEN);
+				resp->version = store.version[user];
+				resp->generation = shared->generation[user % SHM_GENERATIONS];
+				resp->state = 0;
+				log_request("user: %s read secret:%s\n",user_login(&store,user),user_secret(&store,user));
+			}else{
+				reset_response(req,resp);
+				resp->state = 1;
+			}
+		}
+		break;
+		case CAS_SECRET:{
+			session *sess = get_session(&sessions,req->sessId);
+			if(sess != NULL && strcmp(user_login(&store,sess->user),req->login)==0 && storable_field(req->secret)){
+				unsigned int user = sess->user;
+				if(store.version[user] == req->version){
+					if(set_secret(&store,user,req->secret)==-1){
+						bailout(EXIT_FAILURE,"malloc failed");
+					}
+					store.version[user]++;
+					if(persist_user(&store,user)==-1){
+						bailout(EXIT_FAILURE,"malloc failed");
+					}
+					reset_response(req,resp);
+					resp->version = store.version[user];
+					resp->generation = bump_generation(user);
+					resp->state = 0;
+					log_request("user: %s wrote secret:%s version:%u\n",user_login(&store,user),user_secret(&store,user),store.version[user]);
 				}else{
-					(void)fprintf(stdout,"didnt log out user: %s expected login: %s\n",shared->login,sess->login);
-					(void)memset(shared, 0, sizeof(MyShm));
-					shared->state = 1;
-				}
-				int c = sem_post(c_r_sem);
-				if(c!= 0){
-					bailout(EXIT_FAILURE,"client write semaphore error");
+					//hand back the current value so the client can retry right away
+					reset_response(req,resp);
+					mystrcpy(resp->secret,user_secret(&store,user),SECRET_LEN);
+					resp->version = store.version[user];
+					resp->generation = shared->generation[user % SHM_GENERATIONS];
+					resp->state = STATE_CONFLICT;
+					log_request("user: %s secret version conflict, is:%u\n",user_login(&store,user),store.version[user]);
 				}
+			}else{
+				reset_response(req,resp);
+				resp->state = 1;
 			}
-			break;
 		}
-		wait_for_sem(s_sem,"server sem");
-	}
-	if(quit){
-		bailout(EXIT_FAILURE,"server closing due to signal");
+		break;
+		case LOGOUT:{
+			session *sess = get_session(&sessions,req->sessId);
+			if(sess != NULL && strcmp(user_login(&store,sess->user),req->login)==0){
+				log_request("logged out user: %s session id:%d\n",user_login(&store,sess->user),sess->id);
+				drop_session(&sessions,sess->id);
+				reset_response(req,resp);
+				resp->state = 0;
+			}else{
+				log_request("didnt log out user: %s\n",req->login);
+				reset_response(req,resp);
+				resp->state = 1;
+			}
+		}
+		break;
+		case LIST_USERS:
+			fill_page(req,resp,0);
+		break;
+		case EXPORT_USERS:
+			if(exportAllowed){
+				fill_page(req,resp,1);
+			}else{
+				reset_response(req,resp);
+				resp->state = 1;
+			}
+		break;
+		default:
+			reset_response(req,resp);
+			resp->state = 1;
+		break;
 	}
-	bailout(EXIT_FAILURE,"returned?");
-	
-	
-
 }
 
-static void mystrcpy(char *dest,char *source,int size){
-	(void)strncpy(dest,source,size-1);
-	dest[size]='\0';
+static void fill_page(MyRequest *req, MyResponse *resp, int withSecrets){
+	unsigned int i = req->cursor;
+	int used = 0;
+	int count = 0;
+	reset_response(req,resp);
+	while(i < store.count){
+		int len;
+		if(withSecrets){
+			len = snprintf(resp->page+used, SHM_PAGE-used, "%s;%s\n", user_login(&store,i), user_secret(&store,i));
+		}else{
+			len = snprintf(resp->page+used, SHM_PAGE-used, "%s\n", user_login(&store,i));
+		}
+		if(len < 0 || len >= SHM_PAGE-used){
+			//does not fit anymore, goes into the next page
+			resp->page[used] = '\0';
+			break;
+		}
+		used += len;
+		count++;
+		i++;
+	}
+	resp->count = count;
+	//cursor 0 only ever starts a listing, so it marks the end
+	resp->cursor = i < store.count ? i : 0;
+	resp->state = 0;
 }
 
 static void handle_signal(int signo){
@@ -282,222 +616,238 @@ static void handle_signal(int signo){
   if (signo == SIGTERM){
 	  quit = 1;
   }
+  
+  if (signo == SIGUSR1){
+	  trace_request_dump();
+  }
    
 }
 
 static void allocate_ressources(void){
-	//initialize db list
-	db = (List) malloc(sizeof(List));
-	if(db == NULL){
-		bailout(EXIT_FAILURE,"couldnt malloc db");
+	//the semaphores come first, a second server fails on them before it touches the segment
+	s_sem = sem_open(SERVER_SEM, O_CREAT | O_EXCL, PERMISSION, 0);
+	if(s_sem == SEM_FAILED){
+		bailout(EXIT_FAILURE,"creating sem1 failed!");
 	}
-	
-	//initialize session list
-	users = (List) malloc(sizeof(List));
-	if(db == NULL){
-		bailout(EXIT_FAILURE,"couldnt malloc db");
+	createdServerSem = 1;
+	c_w_sem = sem_open(CLIENT_WRITE_SEM, O_CREAT | O_EXCL, PERMISSION, 0);
+	if(c_w_sem == SEM_FAILED){
+		bailout(EXIT_FAILURE,"creating sem3 failed!");
 	}
-	
-	//initialize shared memory
-	shmfd =shm_open(SHM_NAME, O_RDWR | O_CREAT, PERMISSION);
+	createdWriteSem = 1;
+
+	//initialize shared memory, never one that some other server still serves
+	shmfd =shm_open(SHM_NAME, O_RDWR | O_CREAT | O_EXCL, PERMISSION);
 	if(shmfd==-1){
-		bailout(EXIT_FAILURE,"couldnt open or create shared memory");
+		bailout(EXIT_FAILURE,"couldnt create shared memory");
 	}
-	if(ftruncate(shmfd, sizeof *shared) == -1){
+	createdShm = 1;
+	//with -H the segment is rounded up to whole huge pages, clients only map the front
+	shmSize = placement_round(sizeof *shared);
+	if(ftruncate(shmfd, shmSize) == -1){
 		bailout(EXIT_FAILURE,"couldnt set the size of shared memory");
 	}
-	shared = mmap(NULL, sizeof *shared, PROT_READ | PROT_WRITE, MAP_SHARED, shmfd, 0);
+	shared = mmap(NULL, shmSize, PROT_READ | PROT_WRITE, MAP_SHARED, shmfd, 0);
 	if(shared == MAP_FAILED){
+		shared = NULL;
 		bailout(EXIT_FAILURE,"couldnt map shared memory");
 	}
-	
-	//initialize semaphors
-	s_sem = sem_open(SERVER_SEM, O_CREAT | O_EXCL, PERMISSION, 0);
-	if(s_sem == SEM_FAILED){
-		bailout(EXIT_FAILURE,"creating sem1 failed!");
-	}
-	c_r_sem = sem_open(CLIENT_READ_SEM, O_CREAT | O_EXCL, PERMISSION, 0);
-	if(c_r_sem == SEM_FAILED){
-		bailout(EXIT_FAILURE,"creating sem2 failed!");
+	if(placement_bind(shared, shmSize)==-1){
+		(void)fprintf(stderr,"%s couldnt apply numa node or huge pages to shared memory\n",myname);
 	}
-	c_w_sem = sem_open(CLIENT_WRITE_SEM, O_CREAT | O_EXCL, PERMISSION, 1);
-	if(c_w_sem == SEM_FAILED){
-		bailout(EXIT_FAILURE,"creating sem3 failed!");
+	(void)memset(shared, 0, sizeof *shared);
+	int i;
+	for(i=0;i<SHM_SLOTS;i++){
+		if(sem_init(&shared->slot[i].done, 1, 0)==-1){
+			bailout(EXIT_FAILURE,"creating slot sem failed!");
+		}
 	}
-	
-	
+	shared->header.layout = SHM_LAYOUT_VERSION;
+	shared->header.size = sizeof *shared;
+	shared->header.slots = SHM_SLOTS;
+	shared->header.slotSize = sizeof(MyShm);
+	shared->header.page = SHM_PAGE;
+	shared->header.loginLen = LOGIN_LEN;
+	shared->header.passLen = PASS_LEN;
+	shared->header.secretLen = SECRET_LEN;
+	shared->header.pid = getpid();
+	//clients check the magic last, so it is published after everything else
+	__sync_synchronize();
+	shared->header.magic = SHM_MAGIC;
 }
 
 
-static void wait_for_sem(sem_t *sem, char *description){
-	while((sem_wait(sem))==-1){
+static int wait_for_sem(sem_t *sem, long long timeout, char *description){
+	struct timespec deadline;
+	if(clock_gettime(CLOCK_REALTIME,&deadline)==-1){
+		bailout(EXIT_FAILURE,"couldnt read the clock");
+	}
+	timeout = timeout > 0 ? timeout : 0;
+	deadline.tv_sec += (deadline.tv_nsec + timeout) / 1000000000LL;
+	deadline.tv_nsec = (deadline.tv_nsec + timeout) % 1000000000LL;
+	while((sem_timedwait(sem,&deadline))==-1){
 			if(errno == EINTR){
 				if(quit){
 					bailout(EXIT_SUCCESS,"terminated due to signal");
 				}
+				trace_poll();
+			}else if(errno == ETIMEDOUT){
+				return -1;
 			}else{
 				bailout(EXIT_FAILURE,description);
 			}
 	}
+	return 0;
 }
 
-static myDbObject *search_for(List list, char *username) {
-    while (list != NULL) {
-		if(list->data != NULL){
-        if (strcmp(username,((myDbObject*)list->data)->login)==0)
-            return (myDbObject*)list->data;
+static void recover_dead_clients(void){
+	long long now = trace_now();
+	unsigned int checks;
+	unsigned int i;
+	int freeSlot = 0;
+	int value;
+	for(i=0;i<SHM_SLOTS;i++){
+		MyShm *slot = &shared->slot[i];
+		pid_t owner = slot->owner;
+		unsigned long long held;
+		if(owner == 0){
+			freeSlot = 1;
 		}
-        list = list->next;
-    }
-    return NULL;
-}
-
-static session *get_session(List list, int sessionid) {
-    while (list != NULL) {
-		if(list->data != NULL){
-        if (((session*)list->data)->userid==sessionid)
-            return (session*)list->data;
+		if(owner == 0 || owner == SLOT_RECLAIMING || slot->phase == SLOT_READY || !client_gone(owner)){
+			continue;
 		}
-        list = list->next;
-    }
-    return NULL;
-}
-
-static void drop_session(List list,int sessionid){
-	List last = list;
-	list = list->next; 
-	while (list != NULL) {
-		if(list->data != NULL){
-			if (((session*)list->data)->userid==sessionid){
-				last->next=list->next;
-				free(list);
-				return;
-			}
+		//the owner may have freed the slot before it exited and someone else claimed it
+		if(!__sync_bool_compare_and_swap(&slot->owner,owner,SLOT_RECLAIMING)){
+			continue;
+		}
+		if(slot->phase == SLOT_READY){
+			slot->owner = owner;
+			continue;
+		}
+		//a reply the client never waited for would wake the next owner early
+		while(sem_trywait(&slot->done)==0){
+		}
+		held = now > slot->claimed ? now - slot->claimed : 0;
+		slot->phase = SLOT_FREE;
+		__sync_synchronize();
+		slot->owner = 0;
+		__sync_synchronize();
+		freeSlot = 1;
+		if(shared->slotWaiters > 0 && sem_post(c_w_sem)!=0){
+			bailout(EXIT_FAILURE,"client write semaphore error");
+		}
+		shared->stats.recovered_slots++;
+		shared->stats.recovery_ns_total += held;
+		if(held > shared->stats.recovery_ns_max){
+			shared->stats.recovery_ns_max = held;
+		}
+		log_request("recovered slot %u of dead client %d held for %.2f ms\n",i,(int)owner,held/1e6);
+	}
+	//a client that died right after taking the wakeup of a freed slot must not leave the others asleep
+	if(freeSlot && shared->slotWaiters > 0 && sem_getvalue(c_w_sem,&value)==0 && value <= 0){
+		if(sem_post(c_w_sem)!=0){
+			bailout(EXIT_FAILURE,"client write semaphore error");
 		}
-		last = list;
-        list = list->next;
-    }
+		shared->stats.recovered_wakeups++;
+	}
+	lock_handlers();
+	checks = sessions.count < RECOVERY_SESSIONS ? sessions.count : RECOVERY_SESSIONS;
+	for(i=0;i<checks && sessions.count>0;i++){
+		session *sess;
+		if(recoveryCursor >= sessions.count){
+			recoveryCursor = 0;
+		}
+		sess = &sessions.sessions[recoveryCursor];
+		if(sess->owner != 0 && client_gone(sess->owner)){
+			log_request("dropped session %d of dead client %d\n",sess->id,(int)sess->owner);
+			//the last session moves into this position and is looked at next
+			drop_session(&sessions,sess->id);
+			shared->stats.recovered_sessions++;
+		}else{
+			recoveryCursor++;
+		}
+	}
+	unlock_handlers();
 }
 
-static void insert(List list, void *data){
-	List new_node = (List) malloc(sizeof(List));
-	new_node->data = data;
-	new_node->next = list->next;
-	list->next     = new_node;
+static int client_gone(pid_t pid){
+	return kill(pid,0)==-1 && errno==ESRCH;
 }
 
-static void emptyList(List list){
-	List next;
-	while(list->next != NULL){
-		next = list->next;
-		if(list->data != NULL){
-			free(list->data);
-		}
-		if(list != NULL){
-			free(list);
-		}
-		list = next;
+static void follow_primary(void){
+	ReplicaStats rst;
+	const char *errmsg;
+	int result;
+	(void)memset(&rst, 0, sizeof(rst));
+	(void)fprintf(stdout,"standby following %s\n",logPath);
+	(void)fflush(stdout);
+	result = replica_follow(&store,logPath,&quit,&rst,&errmsg);
+	if(result == 1){
+		bailout(EXIT_SUCCESS,"terminated due to signal");
 	}
-	if(list->data != NULL){
-		free(list->data);
+	if(result == -1){
+		(void)fprintf(stderr,"%s %s: %s\n",myname,logPath,errmsg);
+		bailout(EXIT_FAILURE,"couldnt follow change log");
 	}
-	if(list != NULL){
-		free(list);
-	}	
-	
+	takeoverBegin = trace_now();
+	(void)fprintf(stdout,"standby applied %lu records, %lu bytes, max lag %lld bytes, apply rate %.0f records/s, taking over with %u users\n"
+		,rst.records,rst.bytes,rst.max_lag,rst.apply_ns>0?rst.records*1e9/rst.apply_ns:0.0,store.count);
+	replica_release_stale();
 }
 
-static void dumpdb(void){
-	FILE *dbfile;
-	if(!(dbfile = fopen("auth-server.db.csv","w"))){
-		(void)fprintf(stderr,"Couldnt create file %s\n","auth-server.db.csv");
-	}
-	List list = db;
-	while(list != NULL){
-		if(list->data!=NULL){
-			myDbObject *obj = ((myDbObject*)list->data);
-			if(fprintf(dbfile,"%s;%s;%s\n",obj->login,obj->pass,obj->secret)<0){
-				(void)fprintf(stderr,"failed writing line into db file with errno %d",errno);
-				return;
-			}
-		}
-		list = list->next;
+static void apply_placement(void){
+	if(cpuList != NULL && placement_pin(cpuList)==-1){
+		bailout(EXIT_FAILURE,"couldnt pin to the given cpus");
 	}
-	if(fclose(dbfile)==EOF){
-		(void)fprintf(stderr,"failed to close db file with errno %d",errno);
+	if(numaNode >= 0 && placement_node(numaNode)==-1){
+		bailout(EXIT_FAILURE,"couldnt bind memory to the given numa node");
 	}
 }
 
 static void parse_args(int argc, char **argv){
 	myname = argv[0];
 	int c;
-	while ((c = getopt(argc, argv, "l:")) != -1){
+	while ((c = getopt(argc, argv, "l:L:SxU:Hc:N:")) != -1){
 		switch(c){
-			case 'l':{
-				FILE *dbfile;
-				if(!(dbfile = fopen(optarg,"r"))){
-					(void)fprintf(stderr,"Couldnt open file %s\n",optarg);
-					bailout(EXIT_FAILURE,"usage auth-server [-l database]");
-				}else{
-					char buff[50];
-					const char delim[2] = ";";
-					char *token;
-					myDbObject* obj;
-					while (fgets(buff,50,dbfile)!=NULL){
-						obj = (myDbObject*) malloc(sizeof(myDbObject));
-						if(obj==NULL){
-							bailout(EXIT_FAILURE,"malloc failed");
-						}
-						token = strtok(buff,delim);
-						if(token == NULL){
-							bailout(EXIT_FAILURE,"database file corrupted");
-						}
-						if(strlen(token)>19){
-							bailout(EXIT_FAILURE,"database file corrupted");
-						}
-						mystrcpy(obj->login,token,20);
-						
-						token = strtok(NULL,delim);
-						if(token == NULL){
-							bailout(EXIT_FAILURE,"database file corrupted");
-						}
-						if(strlen(token)>19){
-							bailout(EXIT_FAILURE,"database file corrupted");
-						}
-						mystrcpy(obj->pass,token,20);
-						
-						token = strtok(NULL,delim);
-						if(token == NULL){
-							bailout(EXIT_FAILURE,"database file corrupted");
-						}
-						if(strlen(token)>49){
-							bailout(EXIT_FAILURE,"database file corrupted");
-						}
-						if(token[strlen(token)-1]=='\n'){
-							token[strlen(token)-1]='\0';
-						}
-						mystrcpy(obj->secret,token,50);
-						token = strtok(NULL,delim);
-						if(token != NULL){
-							bailout(EXIT_FAILURE,"database file corrupted");
-						}
-						insert(db,obj);
-					}
-					if(fclose(dbfile)==EOF){
-						bailout(EXIT_FAILURE,"error closing db file");
-					}
+			case 'l':
+				dbPath = optarg;
+				break;
+			case 'L':
+				logPath = optarg;
+				break;
+			case 'S':
+				standby = 1;
+				break;
+			case 'U':
+				sockPath = optarg;
+				break;
+			case 'H':
+				placement_huge = 1;
+				break;
+			case 'c':
+				cpuList = optarg;
+				break;
+			case 'N':{
+				char *end;
+				numaNode = (int)strtol(optarg,&end,10);
+				if(*end != '\0' || numaNode < 0){
+					bailout(EXIT_FAILURE,"usage auth-server [-l database] [-L log [-S]] [-x] [-U socket] [-H] [-c cpus] [-N node]");
 				}
 				}
 				break;
-				
+			case 'x':
+				exportAllowed = 1;
+				break;
 			case '?':
-				bailout(EXIT_FAILURE,"usage auth-server [-l database]");
+				bailout(EXIT_FAILURE,"usage auth-server [-l database] [-L log [-S]] [-x] [-U socket] [-H] [-c cpus] [-N node]");
 			default:
 				assert(0);
 				break;
 		}
 	}
-	
+	if(standby && logPath == NULL){
+		bailout(EXIT_FAILURE,"usage auth-server [-l database] [-L log [-S]] [-x] [-U socket] [-H] [-c cpus] [-N node]");
+	}
 }
 
 static void bailout(int exitcode, const char *errmsg){
@@ -506,24 +856,69 @@ static void bailout(int exitcode, const char *errmsg){
 }
 
 static void free_ressources(void){
+	sock_stop();
+	//keeps the other thread out of the db for good, unless we bail out of a handler ourselves
+	if(!(lockOwned && pthread_equal(lockOwner,pthread_self()))){
+		(void)pthread_mutex_lock(&handlerLock);
+	}
 	if(shared!=NULL){
+		int i;
 		shared->state = -1;
-	}
-	if(c_r_sem !=NULL){
-		(void)sem_post(c_r_sem);
+		//wake everyone waiting for a reply or a free slot
+		for(i=0;i<SHM_SLOTS;i++){
+			if(shared->slot[i].phase!=SLOT_FREE){
+				(void)sem_post(&shared->slot[i].done);
+			}
+		}
+		if(c_w_sem != NULL && c_w_sem != SEM_FAILED){
+			(void)sem_post(c_w_sem);
+		}
+		(void)fprintf(stdout,"requests:%lu wakeups:%lu passes:%lu reply posts:%lu client posts:%lu client skipped posts:%lu cache hits:%lu cache misses:%lu\n"
+			,shared->stats.requests,shared->stats.server_wakeups,shared->stats.server_passes
+			,shared->stats.server_reply_posts,shared->clientStats.client_wakeup_posts,shared->clientStats.client_wakeup_skips
+			,shared->clientStats.client_cache_hits,shared->clientStats.client_cache_misses);
+		(void)fprintf(stdout,"socket connections:%lu requests:%lu wakeups:%lu reads:%lu writes:%lu\n"
+			,shared->sockStats.sock_connections,shared->sockStats.sock_requests,shared->sockStats.sock_wakeups
+			,shared->sockStats.sock_reads,shared->sockStats.sock_writes);
+		(void)fprintf(stdout,"failed logins:%lu throttled per login:%lu throttled globally:%lu\n"
+			,shared->stats.login_failures,shared->stats.login_throttled_login,shared->stats.login_throttled_global);
+		(void)fprintf(stdout,"recovered slots:%lu sessions:%lu wakeups:%lu longest held slot:%.2f ms\n"
+			,shared->stats.recovered_slots,shared->stats.recovered_sessions,shared->stats.recovered_wakeups
+			,shared->stats.recovery_ns_max/1e6);
+		(void)munmap(shared, shmSize);
 	}
 	
 	(void)close(shmfd);
-	(void)munmap(shared, sizeof *shared);
-	(void)sem_close(s_sem);
-	(void)sem_close(c_r_sem);
-	(void)sem_close(c_w_sem);
-	(void)shm_unlink(SHM_NAME);	
-	(void)sem_unlink(CLIENT_READ_SEM);
-	(void)sem_unlink(CLIENT_WRITE_SEM);
-	(void)sem_unlink(SERVER_SEM);
-	dumpdb();
-	emptyList(db);
-	emptyList(users);
+	if(s_sem != NULL && s_sem != SEM_FAILED){
+		(void)sem_close(s_sem);
+	}
+	if(c_w_sem != NULL && c_w_sem != SEM_FAILED){
+		(void)sem_close(c_w_sem);
+	}
+	//only names this process created, those of a running server or a primary stay
+	if(createdShm){
+		(void)shm_unlink(SHM_NAME);
+	}
+	if(createdWriteSem){
+		(void)sem_unlink(CLIENT_WRITE_SEM);
+	}
+	if(createdServerSem){
+		(void)sem_unlink(SERVER_SEM);
+	}
+	(void)trace_dump();
+	if(loaded){
+		PersistStats *pst = persist_stats();
+		if(persist_snapshot(&store,"auth-server.db.csv")==-1){
+			(void)fprintf(stderr,"%s couldnt write snapshot\n",myname);
+		}
+		(void)fprintf(stdout,"db users:%u bytes per user:%.1f sessions:%u bytes per session:%.1f\n"
+			,store.count,store.count>0?(double)store_bytes(&store)/store.count:0.0
+			,sessions.count,sessions.count>0?(double)sessions_bytes(&sessions)/sessions.count:0.0);
+		persist_stop();
+		(void)fprintf(stdout,"persist records:%lu bytes:%lu writes:%lu syncs:%lu snapshots:%lu errors:%lu ring full:%lu max inflight:%lu\n"
+			,pst->records,pst->bytes,pst->writes,pst->syncs,pst->snapshots,pst->errors,pst->ring_full,pst->max_inflight);
+	}
+	store_free(&store);
+	sessions_free(&sessions);
 	
 }
\ No newline at end of file
@@ -11,22 +11,18 @@
 #include <assert.h>
 #include <string.h>
 #include <time.h>
+#include <stdarg.h>
+#include "trace.h"
+#include "db.h"
+#include "persist.h"
+#include "placement.h"
+#include "replica.h"
+#include "sockserver.h"
+#include "throttle.h"
 
-typedef struct myDbObjectStruct{
-		char login[20];
-		char pass[20];
-		char secret[50];
-} myDbObject;
-
-typedef struct myUserIdStruct{
-	int userid;
-	char login[20];
-} session;
-
-struct simpleListNode{
-	void *data;
-	struct simpleListNode *next;
-};
-typedef struct simpleListNode* List;
+//the server looks for dead clients this often and never sleeps longer
+#define RECOVERY_INTERVAL_NS (200000000LL)
+//sessions checked for a dead owner per look
+#define RECOVERY_SESSIONS (256)
 
 #endif
\ No newline at end of file
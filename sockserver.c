@@ -0,0 +1,369 @@
+/**
+ * @file sockserver.c
+ * @author David Schrder 1226747
+ * @brief Unix domain socket transport of the auth server
+ * @details A single thread runs a non blocking epoll loop. Every readable
+ *          connection is drained, all complete request frames are handled in
+ *          one go under the handler lock and the replies leave in one write,
+ *          so clients may pipeline as many requests as they like.
+ * @date 08.01.2017
+ */
+#define _GNU_SOURCE
+#include "sockserver.h"
+
+ /**
+ * @brief the epoll loop of the socket thread
+ * @param arg unused
+ */
+static void *sock_loop(void *arg);
+
+ /**
+ * @brief accepts all pending connections
+ */
+static void sock_accept(void);
+
+ /**
+ * @brief reads what is available and handles complete frames
+ * @param conn the connection
+ * @return 0 if the connection stays open, -1 if it has to be closed
+ */
+static int sock_read(Connection *conn);
+
+ /**
+ * @brief writes as much of the pending replies as the socket takes
+ * @param conn the connection
+ * @return 0 if the connection stays open, -1 if it has to be closed
+ */
+static int sock_flush(Connection *conn);
+
+ /**
+ * @brief registers for the events the connection needs right now
+ * @param conn the connection
+ * @return 0 on success, -1 on error
+ */
+static int sock_rearm(Connection *conn);
+
+ /**
+ * @brief closes a connection and frees its buffers
+ * @param conn the connection
+ */
+static void sock_close(Connection *conn);
+
+ /**
+ * @brief appends a reply frame to the output buffer
+ * @param conn the connection
+ * @param resp the reply
+ * @return 0 on success, -1 if realloc failed
+ */
+static int sock_queue(Connection *conn, MyResponse *resp);
+
+ /**
+ * @brief checks that every string of a request ends within its field
+ * @param req the request read from a frame
+ * @return 1 if it may be handled, 0 if the connection has to be closed
+ */
+static int sock_terminated(MyRequest *req);
+
+ /**
+ * @brief checks all complete frames of the input before any of them is handled
+ * @param conn the connection
+ * @return number of complete frames, -1 if one of them is broken
+ */
+static int sock_frames(Connection *conn);
+
+static int listenfd = -1;
+static int epfd = -1;
+static char sockPath[sizeof(((struct sockaddr_un*)0)->sun_path)];
+static SockHandler handler;
+static SockLock lockHandlers;
+static SockLock unlockHandlers;
+static MySockStats *stats;
+
+int sock_start(const char *path, SockHandler requestHandler, SockLock lock, SockLock unlock, MySockStats *sockStats){
+	struct sockaddr_un addr;
+	struct epoll_event ev;
+	sigset_t blocked;
+	sigset_t old;
+	pthread_t thread;
+	int err;
+	if(strlen(path) >= sizeof(addr.sun_path)){
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	handler = requestHandler;
+	lockHandlers = lock;
+	unlockHandlers = unlock;
+	stats = sockStats;
+	(void)memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	(void)strcpy(addr.sun_path, path);
+	listenfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(listenfd == -1){
+		return -1;
+	}
+	//only one server can hold the semaphores, so an existing file is stale
+	(void)unlink(path);
+	if(bind(listenfd, (struct sockaddr*)&addr, sizeof(addr)) == -1){
+		return -1;
+	}
+	(void)strcpy(sockPath, path);
+	if(listen(listenfd, SOCK_BACKLOG) == -1 || fcntl(listenfd, F_SETFL, O_NONBLOCK) == -1){
+		return -1;
+	}
+	epfd = epoll_create(SOCK_EVENTS);
+	if(epfd == -1){
+		return -1;
+	}
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if(epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev) == -1){
+		return -1;
+	}
+	//signals stay with the main thread, which waits on the shm semaphore
+	(void)sigfillset(&blocked);
+	(void)pthread_sigmask(SIG_BLOCK, &blocked, &old);
+	err = pthread_create(&thread, NULL, sock_loop, NULL);
+	(void)pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if(err != 0){
+		errno = err;
+		return -1;
+	}
+	(void)pthread_detach(thread);
+	return 0;
+}
+
+void sock_stop(void){
+	if(listenfd != -1){
+		(void)close(listenfd);
+		listenfd = -1;
+	}
+	if(sockPath[0] != '\0'){
+		(void)unlink(sockPath);
+		sockPath[0] = '\0';
+	}
+}
+
+static void *sock_loop(void *arg){
+	struct epoll_event events[SOCK_EVENTS];
+	(void)arg;
+	for(;;){
+		int n = epoll_wait(epfd, events, SOCK_EVENTS, -1);
+		int i;
+		if(n == -1){
+			if(errno == EINTR){
+				continue;
+			}
+			(void)fprintf(stderr,"socket transport stopped, epoll_wait failed with errno %d\n",errno);
+			return NULL;
+		}
+		stats->sock_wakeups++;
+		for(i=0;i<n;i++){
+			Connection *conn = (Connection*) events[i].data.ptr;
+			if(conn == NULL){
+				sock_accept();
+				continue;
+			}
+			if(events[i].events & (EPOLLERR | EPOLLHUP)){
+				sock_close(conn);
+				continue;
+			}
+			if((events[i].events & EPOLLOUT) && sock_flush(conn) == -1){
+				sock_close(conn);
+				continue;
+			}
+			if((events[i].events & EPOLLIN) && sock_read(conn) == -1){
+				sock_close(conn);
+				continue;
+			}
+			if(sock_rearm(conn) == -1){
+				sock_close(conn);
+			}
+		}
+	}
+	return NULL;
+}
+
+static void sock_accept(void){
+	for(;;){
+		struct epoll_event ev;
+		struct ucred cred;
+		socklen_t credLen = sizeof(cred);
+		Connection *conn;
+		int fd = accept(listenfd, NULL, NULL);
+		if(fd == -1){
+			if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+				(void)fprintf(stderr,"accept failed with errno %d\n",errno);
+			}
+			return;
+		}
+		if(fcntl(fd, F_SETFL, O_NONBLOCK) == -1 || (conn = (Connection*) malloc(sizeof(Connection))) == NULL){
+			(void)close(fd);
+			continue;
+		}
+		conn->fd = fd;
+		//sessions of the peer are dropped once it is gone
+		conn->peer = getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &credLen) == 0 ? cred.pid : 0;
+		conn->inUsed = 0;
+		conn->out = NULL;
+		conn->outUsed = 0;
+		conn->outSent = 0;
+		conn->outCap = 0;
+		conn->events = EPOLLIN;
+		ev.events = conn->events;
+		ev.data.ptr = conn;
+		if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1){
+			(void)close(fd);
+			free(conn);
+			continue;
+		}
+		stats->sock_connections++;
+	}
+}
+
+static int sock_read(Connection *conn){
+	for(;;){
+		size_t pos = 0;
+		int handled = 0;
+		int frames;
+		ssize_t got;
+		if(conn->outUsed - conn->outSent >= SOCK_OUT_LIMIT){
+			//reading resumes once the client took its replies
+			return 0;
+		}
+		got = read(conn->fd, conn->in + conn->inUsed, sizeof(conn->in) - conn->inUsed);
+		if(got == 0){
+			return -1;
+		}
+		if(got == -1){
+			if(errno == EINTR){
+				continue;
+			}
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+		}
+		stats->sock_reads++;
+		conn->inUsed += got;
+		frames = sock_frames(conn);
+		if(frames == -1){
+			//any local process may connect, so a broken frame ends its connection before it holds the lock
+			return -1;
+		}
+		while(handled < frames){
+			MyRequest req;
+			MyResponse resp;
+			(void)memcpy(&req, conn->in + pos + FRAME_HEADER, REQUEST_FRAME_SIZE);
+			pos += FRAME_HEADER + REQUEST_FRAME_SIZE;
+			//resp is reused across connections, the frame carries all fields before the page
+			(void)memset(&resp, 0, offsetof(MyResponse,page)+1);
+			if(handled == 0){
+				lockHandlers();
+			}
+			TRACE_BEGIN(requestBegin);
+			handler(&req, &resp, conn->peer);
+			TRACE_END("sock_request",requestBegin,req.command);
+			handled++;
+			if(sock_queue(conn, &resp) == -1){
+				unlockHandlers();
+				stats->sock_requests += handled;
+				return -1;
+			}
+		}
+		if(handled > 0){
+			unlockHandlers();
+			stats->sock_requests += handled;
+		}
+		(void)memmove(conn->in, conn->in + pos, conn->inUsed - pos);
+		conn->inUsed -= pos;
+		if(sock_flush(conn) == -1){
+			return -1;
+		}
+	}
+}
+
+static int sock_queue(Connection *conn, MyResponse *resp){
+	uint32_t len = RESPONSE_FRAME_SIZE(resp);
+	if(conn->outUsed + FRAME_HEADER + len > conn->outCap){
+		size_t cap = conn->outCap == 0 ? 4096 : conn->outCap;
+		char *grown;
+		while(cap < conn->outUsed + FRAME_HEADER + len){
+			cap *= 2;
+		}
+		grown = (char*) realloc(conn->out, cap);
+		if(grown == NULL){
+			return -1;
+		}
+		conn->out = grown;
+		conn->outCap = cap;
+	}
+	(void)memcpy(conn->out + conn->outUsed, &len, FRAME_HEADER);
+	(void)memcpy(conn->out + conn->outUsed + FRAME_HEADER, resp, len);
+	conn->outUsed += FRAME_HEADER + len;
+	return 0;
+}
+
+static int sock_flush(Connection *conn){
+	while(conn->outSent < conn->outUsed){
+		ssize_t sent = write(conn->fd, conn->out + conn->outSent, conn->outUsed - conn->outSent);
+		if(sent == -1){
+			if(errno == EINTR){
+				continue;
+			}
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+		}
+		stats->sock_writes++;
+		conn->outSent += sent;
+	}
+	conn->outUsed = 0;
+	conn->outSent = 0;
+	return 0;
+}
+
+static int sock_rearm(Connection *conn){
+	struct epoll_event ev;
+	uint32_t events = 0;
+	if(conn->outUsed - conn->outSent < SOCK_OUT_LIMIT){
+		events |= EPOLLIN;
+	}
+	if(conn->outSent < conn->outUsed){
+		events |= EPOLLOUT;
+	}
+	if(events == conn->events){
+		return 0;
+	}
+	conn->events = events;
+	ev.events = events;
+	ev.data.ptr = conn;
+	return epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+}
+
+static void sock_close(Connection *conn){
+	(void)epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+	(void)close(conn->fd);
+	free(conn->out);
+	free(conn);
+}
+
+static int sock_frames(Connection *conn){
+	size_t pos = 0;
+	int frames = 0;
+	while(conn->inUsed - pos >= FRAME_HEADER + REQUEST_FRAME_SIZE){
+		uint32_t len;
+		MyRequest req;
+		(void)memcpy(&len, conn->in + pos, FRAME_HEADER);
+		if(len != REQUEST_FRAME_SIZE){
+			return -1;
+		}
+		(void)memcpy(&req, conn->in + pos + FRAME_HEADER, REQUEST_FRAME_SIZE);
+		if(!sock_terminated(&req)){
+			return -1;
+		}
+		pos += FRAME_HEADER + REQUEST_FRAME_SIZE;
+		frames++;
+	}
+	return frames;
+}
+
+static int sock_terminated(MyRequest *req){
+	return memchr(req->login, '\0', sizeof(req->login)) != NULL
+		&& memchr(req->pass, '\0', sizeof(req->pass)) != NULL
+		&& memchr(req->secret, '\0', sizeof(req->secret)) != NULL;
+}
@@ -0,0 +1,60 @@
+#ifndef myauthsockserver
+#define myauthsockserver
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include "myshared.h"
+#include "trace.h"
+
+//events handled per epoll_wait
+#define SOCK_EVENTS (64)
+//requests read per connection and batch
+#define SOCK_IN_FRAMES (64)
+//replies buffered per connection before it stops reading
+#define SOCK_OUT_LIMIT (256*1024)
+#define SOCK_BACKLOG (64)
+
+ /*
+ * executes one request of the client with pid owner, 0 if unknown,
+ * called between the lock and unlock given to sock_start
+ */
+typedef void (*SockHandler)(MyRequest *req, MyResponse *resp, pid_t owner);
+typedef void (*SockLock)(void);
+
+typedef struct myconnectionstruct {
+	int fd;
+	pid_t peer;
+	uint32_t events;
+	size_t inUsed;
+	char in[SOCK_IN_FRAMES*(FRAME_HEADER+REQUEST_FRAME_SIZE)];
+	char *out;
+	size_t outUsed;
+	size_t outSent;
+	size_t outCap;
+} Connection;
+
+ /**
+ * @brief listens on a unix socket and serves it from an epoll thread
+ * @param path path of the socket, a stale file is replaced
+ * @param handler executes the requests
+ * @param lock called before a batch of requests is handled
+ * @param unlock called after the batch
+ * @param stats counters to update, only written by the socket thread
+ * @return 0 on success, -1 on error with errno set
+ */
+int sock_start(const char *path, SockHandler handler, SockLock lock, SockLock unlock, MySockStats *stats);
+
+ /**
+ * @brief stops accepting connections and removes the socket file
+ */
+void sock_stop(void);
+
+#endif
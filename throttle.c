@@ -0,0 +1,112 @@
+/**
+ * @file throttle.c
+ * @author David Schrder 1226747
+ * @brief Failed login throttling of the auth server
+ * @details Token buckets per login in a set associative table and one for
+ *          all logins. A bucket only stores when it is full again, a token
+ *          costs one interval of that time and an attempt is refused while
+ *          the bucket would need more than burst intervals to fill.
+ *          A login only takes over a bucket that is full again, so evicting
+ *          never forgets a failure. While all buckets of its set drain, a
+ *          login shares the emptiest one and is throttled with its owner.
+ * @date 08.01.2017
+ */
+#include "throttle.h"
+
+ /**
+ * @brief fnv-1a hash of a login
+ * @param login the login
+ */
+static uint32_t hash_login(const char *login);
+
+ /**
+ * @brief picks the bucket that counts the failures of a login
+ * @param hash hash of the login
+ * @param now monotonic time in ns
+ * @return the bucket of the login, else the way of its set that is full
+ *         again the longest, else the way of its set that drains the most
+ */
+static ThrottleBucket *find_bucket(uint32_t hash, long long now);
+
+ /**
+ * @brief checks whether a bucket holds a token
+ * @param bucket the bucket
+ * @param burst tokens of a full bucket
+ * @param interval ns to earn one token back
+ * @param now monotonic time in ns
+ * @return 1 if a token is left, 0 if the bucket is empty
+ */
+static int has_token(ThrottleBucket *bucket, int burst, long long interval, long long now);
+
+ /**
+ * @brief takes a token of a bucket
+ * @param bucket the bucket
+ * @param interval ns to earn one token back
+ * @param now monotonic time in ns
+ */
+static void take_token(ThrottleBucket *bucket, long long interval, long long now);
+
+ /*
+ * only touched by handle_request, so under the handler lock
+ */
+static ThrottleBucket buckets[THROTTLE_SETS*THROTTLE_WAYS];
+static ThrottleBucket global;
+
+int throttle_check(const char *login, long long now){
+	ThrottleBucket *bucket = find_bucket(hash_login(login), now);
+	if(!has_token(&global, THROTTLE_GLOBAL_BURST, THROTTLE_GLOBAL_INTERVAL_NS, now)){
+		return THROTTLE_GLOBAL;
+	}
+	//a bucket that is full again holds a token whoever owns it
+	if(!has_token(bucket, THROTTLE_LOGIN_BURST, THROTTLE_LOGIN_INTERVAL_NS, now)){
+		return THROTTLE_LOGIN;
+	}
+	return THROTTLE_NONE;
+}
+
+void throttle_failed(const char *login, long long now){
+	uint32_t hash = hash_login(login);
+	ThrottleBucket *bucket = find_bucket(hash, now);
+	if(bucket->hash != hash && bucket->full <= now){
+		//full again, the previous login has nothing left to forget
+		bucket->hash = hash;
+		bucket->full = 0;
+	}
+	take_token(bucket, THROTTLE_LOGIN_INTERVAL_NS, now);
+	take_token(&global, THROTTLE_GLOBAL_INTERVAL_NS, now);
+}
+
+static ThrottleBucket *find_bucket(uint32_t hash, long long now){
+	ThrottleBucket *set = &buckets[(hash % THROTTLE_SETS)*THROTTLE_WAYS];
+	ThrottleBucket *oldest = &set[0];
+	ThrottleBucket *emptiest = &set[0];
+	int i;
+	for(i=0;i<THROTTLE_WAYS;i++){
+		if(set[i].hash == hash){
+			return &set[i];
+		}
+		if(set[i].full < oldest->full){
+			oldest = &set[i];
+		}
+		if(set[i].full > emptiest->full){
+			emptiest = &set[i];
+		}
+	}
+	return oldest->full <= now ? oldest : emptiest;
+}
+
+static uint32_t hash_login(const char *login){
+	uint32_t hash = 2166136261u;
+	while(*login != '\0'){
+		hash = (hash ^ (unsigned char)*login++) * 16777619u;
+	}
+	return hash;
+}
+
+static int has_token(ThrottleBucket *bucket, int burst, long long interval, long long now){
+	return bucket->full - now <= (burst-1)*interval;
+}
+
+static void take_token(ThrottleBucket *bucket, long long interval, long long now){
+	bucket->full = (bucket->full > now ? bucket->full : now) + interval;
+}
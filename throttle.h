@@ -0,0 +1,43 @@
+#ifndef myauththrottle
+#define myauththrottle
+#include <stdint.h>
+#include <string.h>
+
+//the per login table has THROTTLE_SETS sets of THROTTLE_WAYS buckets
+#define THROTTLE_SETS (256)
+#define THROTTLE_WAYS (4)
+//failed logins a login may burst and how fast it earns them back
+#define THROTTLE_LOGIN_BURST (5)
+#define THROTTLE_LOGIN_INTERVAL_NS (1000000000LL)
+//the same for all failed logins together
+#define THROTTLE_GLOBAL_BURST (200)
+#define THROTTLE_GLOBAL_INTERVAL_NS (10000000LL)
+
+#define THROTTLE_NONE (0)
+#define THROTTLE_LOGIN (1)
+#define THROTTLE_GLOBAL (2)
+
+ /*
+ * a token bucket kept as the time it is full again, 0 is full
+ */
+typedef struct mythrottlebucketstruct {
+	uint32_t hash;
+	long long full;
+} ThrottleBucket;
+
+ /**
+ * @brief checks whether a login attempt may be looked up
+ * @param login the login of the attempt
+ * @param now monotonic time in ns
+ * @return THROTTLE_NONE, or THROTTLE_LOGIN or THROTTLE_GLOBAL for the bucket that is empty
+ */
+int throttle_check(const char *login, long long now);
+
+ /**
+ * @brief takes a token of the login and the global bucket for a failed attempt
+ * @param login the login of the attempt
+ * @param now monotonic time in ns
+ */
+void throttle_failed(const char *login, long long now);
+
+#endif
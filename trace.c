@@ -0,0 +1,107 @@
+/**
+ * @file trace.c
+ * @author David Schrder 1226747
+ * @brief Span tracing for client and server
+ * @details Keeps the last TRACE_SPANS spans of a process in a ring buffer and
+ *          writes them as chrome trace json, which chrome://tracing and perfetto
+ *          open directly. Timestamps are CLOCK_MONOTONIC so traces of client
+ *          and server processes on one host line up.
+ * @date 08.01.2017
+ */
+#define _GNU_SOURCE
+#include "trace.h"
+#include <sys/syscall.h>
+
+int trace_enabled = 0;
+
+static TraceSpan *spans;
+static unsigned long recorded;
+static const char *processName;
+static volatile sig_atomic_t dumpRequested = 0;
+
+ /*
+ * kernel id of the calling thread, looked up on its first span
+ */
+static __thread int threadId;
+
+void trace_init(const char *process){
+	char *env = getenv(TRACE_ENV);
+	processName = process;
+	if(env == NULL || env[0] == '\0' || strcmp(env,"0") == 0){
+		return;
+	}
+	spans = (TraceSpan*) calloc(TRACE_SPANS, sizeof(TraceSpan));
+	if(spans == NULL){
+		(void)fprintf(stderr,"%s couldnt allocate trace buffer, tracing disabled\n",process);
+		return;
+	}
+	trace_enabled = 1;
+}
+
+long long trace_now(void){
+	struct timespec ts;
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+void trace_span(const char *name, long long begin, int arg){
+	//the server records from its shm loop and its socket thread
+	unsigned long pos = __sync_fetch_and_add(&recorded,1);
+	TraceSpan *span = &spans[pos % TRACE_SPANS];
+	span->name = name;
+	span->begin = begin;
+	span->end = trace_now();
+	span->arg = arg;
+	//spans of the socket thread overlap those of the main thread, so each gets its own track
+	if(threadId == 0){
+		threadId = (int)syscall(SYS_gettid);
+	}
+	span->tid = threadId;
+}
+
+void trace_request_dump(void){
+	dumpRequested = 1;
+}
+
+void trace_poll(void){
+	if(dumpRequested){
+		dumpRequested = 0;
+		(void)trace_dump();
+	}
+}
+
+int trace_dump(void){
+	char path[64];
+	FILE *out;
+	unsigned long first;
+	unsigned long i;
+	int pid = (int)getpid();
+	if(!trace_enabled){
+		return 0;
+	}
+	(void)snprintf(path, sizeof(path), "auth-trace.%s.%d.json", processName, pid);
+	if(!(out = fopen(path,"w"))){
+		(void)fprintf(stderr,"Couldnt create file %s\n",path);
+		return -1;
+	}
+	(void)fprintf(out,"{\"traceEvents\":[\n");
+	(void)fprintf(out,"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",pid,pid,processName);
+	first = recorded > TRACE_SPANS ? recorded - TRACE_SPANS : 0;
+	for(i=first;i<recorded;i++){
+		TraceSpan *span = &spans[i % TRACE_SPANS];
+		//chrome trace wants microseconds
+		(void)fprintf(out,",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+			span->name,pid,span->tid,span->begin/1000.0,(span->end-span->begin)/1000.0);
+		if(span->arg >= 0){
+			(void)fprintf(out,",\"args\":{\"cmd\":%d}",span->arg);
+		}
+		(void)fprintf(out,"}");
+	}
+	(void)fprintf(out,"\n]}\n");
+	if(fclose(out)==EOF){
+		(void)fprintf(stderr,"failed to close trace file with errno %d\n",errno);
+		return -1;
+	}
+	(void)fprintf(stderr,"%s wrote %lu spans to %s\n",processName,recorded-first,path);
+	return 0;
+}
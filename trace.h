@@ -0,0 +1,66 @@
+#ifndef mytrace
+#define mytrace
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+
+//number of spans kept per process, older ones are overwritten
+#define TRACE_SPANS (16384)
+#define TRACE_ENV "AUTH_TRACE"
+
+typedef struct mytracespanstruct {
+	const char *name;
+	long long begin;
+	long long end;
+	int arg;
+	int tid;
+} TraceSpan;
+
+ /*
+ * set by trace_init if tracing is enabled, checked before taking timestamps
+ */
+extern int trace_enabled;
+
+ /**
+ * @brief enables tracing if the AUTH_TRACE environment variable is set
+ * @param process name of the process shown in the trace viewer
+ */
+void trace_init(const char *process);
+
+ /**
+ * @brief current monotonic time in nanoseconds
+ */
+long long trace_now(void);
+
+ /**
+ * @brief records a finished span in the ring buffer
+ * @param name static name of the span
+ * @param begin start time from trace_now
+ * @param arg value shown as cmd in the viewer, -1 for none
+ */
+void trace_span(const char *name, long long begin, int arg);
+
+ /**
+ * @brief marks that the spans should be dumped, safe to call from a signal handler
+ */
+void trace_request_dump(void);
+
+ /**
+ * @brief dumps the spans if a dump was requested
+ */
+void trace_poll(void);
+
+ /**
+ * @brief writes all recorded spans as chrome trace json to auth-trace.<process>.<pid>.json
+ * @return 0 on success, -1 on error
+ */
+int trace_dump(void);
+
+#define TRACE_BEGIN(var) long long var = trace_enabled ? trace_now() : 0
+#define TRACE_END(name,var,arg) do{ if(trace_enabled){ trace_span((name),(var),(arg)); } }while(0)
+
+#endif